@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <nyamodbus/nyamodbus_codec.h>
+#include <nyamodbus/nyamodbus_utils.h>
+
+#define BENCH_REGISTERS  125
+#define BENCH_ITERATIONS 200000
+
+static uint8_t  packet[BENCH_REGISTERS * 2];
+static uint16_t registers[BENCH_REGISTERS];
+static float    floats[BENCH_REGISTERS / 2];
+
+// Get current time in nanoseconds
+static uint64_t bench_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Print benchmark result
+//  name: benchmark name
+// start: start time
+static void bench_report(const char * name, uint64_t start)
+{
+	uint64_t elapsed = bench_time() - start;
+
+	printf("%-24s %8.2f ns/packet\n", name, (double)elapsed / BENCH_ITERATIONS);
+}
+
+// Decode registers with inline shifts (scalar baseline)
+static void bench_decode_scalar(void)
+{
+	uint64_t start = bench_time();
+	int n, i;
+
+	for(n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		for(i = 0; i < BENCH_REGISTERS; i++)
+			registers[i] = (((uint16_t)packet[i * 2]) << 8) | packet[i * 2 + 1];
+
+		__asm__ __volatile__("" : : "r"(registers) : "memory");
+	}
+
+	bench_report("decode u16 (inline)", start);
+}
+
+// Decode registers with codec
+static void bench_decode_codec(void)
+{
+	uint64_t start = bench_time();
+	int n;
+
+	for(n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		nyamodbus_decode_u16(registers, packet, BENCH_REGISTERS);
+		__asm__ __volatile__("" : : "r"(registers) : "memory");
+	}
+
+	bench_report("decode u16 (codec)", start);
+}
+
+// Encode registers with codec
+static void bench_encode_codec(void)
+{
+	uint64_t start = bench_time();
+	int n;
+
+	for(n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		nyamodbus_encode_u16(packet, registers, BENCH_REGISTERS);
+		__asm__ __volatile__("" : : "r"(packet) : "memory");
+	}
+
+	bench_report("encode u16 (codec)", start);
+}
+
+// Decode floats register by register
+static void bench_decode_f32_pairs(void)
+{
+	uint64_t start = bench_time();
+	int n, i;
+
+	for(n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		nyamodbus_decode_u16(registers, packet, BENCH_REGISTERS);
+		for(i = 0; i < BENCH_REGISTERS / 2; i++)
+			floats[i] = nyamodbus_regs_to_f32(&registers[i * 2], WORD_ORDER_CDAB);
+
+		__asm__ __volatile__("" : : "r"(floats) : "memory");
+	}
+
+	bench_report("decode f32 (pairs)", start);
+}
+
+// Decode floats in bulk
+static void bench_decode_f32_bulk(void)
+{
+	uint64_t start = bench_time();
+	int n;
+
+	for(n = 0; n < BENCH_ITERATIONS; n++)
+	{
+		nyamodbus_decode_f32(floats, packet, BENCH_REGISTERS / 2, WORD_ORDER_CDAB);
+		__asm__ __volatile__("" : : "r"(floats) : "memory");
+	}
+
+	bench_report("decode f32 (bulk)", start);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+
+	for(i = 0; i < sizeof(packet); i++)
+		packet[i] = (uint8_t)(i * 7 + 3);
+
+	printf("Codec kernel: %s, %d registers per packet\n", nyamodbus_codec_kernel(), BENCH_REGISTERS);
+
+	bench_decode_scalar();
+	bench_decode_codec();
+	bench_encode_codec();
+	bench_decode_f32_pairs();
+	bench_decode_f32_bulk();
+
+	// Self check
+	nyamodbus_decode_u16(registers, packet, BENCH_REGISTERS);
+	for(i = 0; i < BENCH_REGISTERS; i++)
+	{
+		if(registers[i] != get_u16_value(&packet[i * 2], 0))
+		{
+			printf("Decode mismatch at %u\n", i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,34 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <emulator/emulator.h>
+#include <emulator/emumaster.h>
+
+// Echo check: emulator returns sent frames to sender, master and slave must skip them
+
+#define ECHO_REQUESTS  10
+#define ECHO_REGISTERS 10
+
+int main(int argc, char *argv[])
+{
+	uint32_t values;
+	uint32_t errors;
+	int i;
+
+	master_start();
+	emu_start(&emuholding);
+	usleep(10000);
+
+	for(i = 0; i < ECHO_REQUESTS; i++)
+	{
+		master_read_holdings(0x11, 1, ECHO_REGISTERS);
+		usleep(20000);
+	}
+
+	emu_stop();
+	master_stop();
+
+	master_get_counters(&values, &errors);
+	printf("Echo: values %u of %u, errors %u\n", values, ECHO_REQUESTS * ECHO_REGISTERS, errors);
+	return ((values == ECHO_REQUESTS * ECHO_REGISTERS) && (errors == 0)) ? 0 : 1;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <nyamodbus/nyamodbus.h>
+#include <nyamodbus/nyamodbus_slave.h>
+
+// Interrupt receive demo: thread simulates UART interrupt (byte + idle line) and DMA (whole frame)
+
+#define ISR_FRAMES 200
+
+// Frames queued before processing
+#define ISR_QUEUED 6
+
+static uint16_t registers[16];
+static volatile int responses = 0;
+static int          invalid = 0;
+
+// Check answer: 4 holding registers from 0
+//   data: answer with crc
+//   size: answer size
+// return: true, if answer is valid
+static bool isr_check(const uint8_t * data, uint8_t size)
+{
+	uint8_t expected[13] = { 0x11, FUNCTION_READ_HOLDING, 0x08 };
+	int i;
+
+	for(i = 0; i < 4; i++)
+	{
+		expected[3 + i * 2] = registers[i] >> 8;
+		expected[4 + i * 2] = registers[i] & 0xFF;
+	}
+
+	nyamodbus_make_frame(expected, expected, 11);
+	return (size == sizeof(expected)) && (memcmp(data, expected, size) == 0);
+}
+
+// Slave answer (main thread)
+static bool isr_send(const uint8_t * data, uint8_t size)
+{
+	if(!isr_check(data, size))
+		invalid++;
+
+	__atomic_add_fetch(&responses, 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static enum_nyamodbus_error isr_readholding(uint16_t id, uint16_t * result)
+{
+	if(id >= 16)
+		return ERROR_NO_DATAADDRESS;
+
+	*result = registers[id];
+	return ERROR_OK;
+}
+
+static const str_modbus_io isr_io = {
+	.send    = isr_send,
+	.receive = 0
+};
+
+static str_nyamodbus_state isr_state;
+static str_nyamodbus_rx    isr_rx;
+static str_nyamodbus_stats isr_stats;
+static uint8_t             isr_address = 0x11;
+
+static const str_nyamodbus_device isr_modbus = {
+	.io    = &isr_io,
+	.state = &isr_state,
+	.stats = &isr_stats,
+	.rx    = &isr_rx
+};
+
+static const str_nyamodbus_slave_device isr_slave = {
+	.device      = &isr_modbus,
+	.address     = &isr_address,
+	.readholding = isr_readholding
+};
+
+static volatile bool isr_done = false;
+static uint64_t      isr_latency_ns = 0;
+
+// Request: 4 holding registers from 0
+static uint8_t isr_request[8];
+static uint8_t isr_request_size = 0;
+
+// Get current time in nanoseconds
+static uint64_t isr_time(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Add request as interrupt
+// mode: 0 - bytes and idle line, 1 - DMA, 2 - bytes and DMA rest of frame
+static void isr_add_request(int mode)
+{
+	int i;
+
+	switch(mode)
+	{
+	case 0:
+		// UART interrupt for each byte, idle line at end
+		for(i = 0; i < isr_request_size; i++)
+			nyamodbus_rx_byte(&isr_modbus, isr_request[i]);
+
+		nyamodbus_rx_frame_end(&isr_modbus);
+		break;
+
+	case 1:
+		// DMA + idle line: whole frame
+		nyamodbus_rx_frame(&isr_modbus, isr_request, isr_request_size);
+		break;
+
+	default:
+		// First bytes by interrupt, rest by DMA with idle line
+		for(i = 0; i < 3; i++)
+			nyamodbus_rx_byte(&isr_modbus, isr_request[i]);
+
+		nyamodbus_rx_frame(&isr_modbus, &isr_request[3], isr_request_size - 3);
+		break;
+	}
+}
+
+// Interrupt simulator: sends requests and waits for answers
+static void * isr_thread(void * arg)
+{
+	int n;
+
+	for(n = 0; n < ISR_FRAMES; n++)
+	{
+		int expected = __atomic_load_n(&responses, __ATOMIC_ACQUIRE) + 1;
+		uint64_t start = isr_time();
+
+		isr_add_request(n % 3);
+
+		while(__atomic_load_n(&responses, __ATOMIC_ACQUIRE) < expected)
+			sched_yield();
+
+		isr_latency_ns += isr_time() - start;
+	}
+
+	isr_done = true;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const uint8_t request[6] = { 0x11, FUNCTION_READ_HOLDING, 0x00, 0x00, 0x00, 0x04 };
+	pthread_t thread;
+	uint64_t  last;
+	int       i;
+
+	for(i = 0; i < 4; i++)
+		registers[i] = 0x1234 + i * 0x1111;
+
+	isr_request_size = nyamodbus_make_frame(isr_request, request, sizeof(request));
+	nyamodbus_slave_init(&isr_slave);
+
+	// Several frames are queued before main loop: all of them are answered by one call
+	for(i = 0; i < ISR_QUEUED; i++)
+		isr_add_request(i % 3);
+
+	nyamodbus_slave_main(&isr_slave);
+	printf("Queued frames: %d, responses: %d\n", ISR_QUEUED, responses);
+	if(responses != ISR_QUEUED)
+		return 1;
+
+	responses = 0;
+	pthread_create(&thread, 0, isr_thread, 0);
+
+	// Main loop: silence timer is not needed, frames are ended by interrupt
+	last = isr_time();
+	while(!isr_done)
+	{
+		uint64_t now = isr_time();
+
+		nyamodbus_slave_tick(&isr_slave, (uint32_t)((now - last) / 1000));
+		nyamodbus_slave_main(&isr_slave);
+		last = now;
+	}
+
+	pthread_join(thread, 0);
+
+	printf("Frames: %d, responses: %d, invalid responses: %d, bus messages: %d, crc errors: %d\n", ISR_FRAMES, responses, invalid,
+	       nyamodbus_stats_get(&isr_modbus, STAT_BUS_MESSAGES), nyamodbus_stats_get(&isr_modbus, STAT_BUS_ERRORS));
+	printf("Average request to answer: %.1f us\n", (double)isr_latency_ns / ISR_FRAMES / 1000);
+
+	return ((responses == ISR_FRAMES) && (invalid == 0)) ? 0 : 1;
+}
@@ -110,6 +110,10 @@ void read_devid(void)
 
 static void process_modbus(int argc, char *argv[], const char * dev)
 {
+	// Adapter receives sent bytes
+	if((argc > 0) && (strcmp(argv[0], "echo") == 0))
+		mbserial_set_echo(true);
+	
 	if(mbserial_master_start(dev, &master))
 	{
 		puts("Started");
@@ -133,7 +137,7 @@ int main(int argc, char *argv[])
 	else
 	{
 		puts("Usage:");
-		printf("%s <dev>\n", argv[0]);
+		printf("%s <dev> [echo]\n", argv[0]);
 		
 	}
 	return 0;
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <string.h>
+#include <nyamodbus/nyamodbus.h>
+#include <nyamodbus/nyamodbus_slave.h>
+
+// Slave regression check: requests are added as received frames, answers are compared with expected
+
+#define CHECK_REGISTERS 16
+
+static uint16_t registers[CHECK_REGISTERS];
+static uint8_t  reply[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+static uint8_t  reply_size = 0;
+static int      failed = 0;
+
+// Store slave answer
+static bool check_send(const uint8_t * data, uint8_t size)
+{
+	memcpy(reply, data, size);
+	reply_size = size;
+	return true;
+}
+
+static enum_nyamodbus_error check_readholding(uint16_t id, uint16_t * result)
+{
+	if(id >= CHECK_REGISTERS)
+		return ERROR_NO_DATAADDRESS;
+
+	*result = registers[id];
+	return ERROR_OK;
+}
+
+static enum_nyamodbus_error check_writeholding(uint16_t id, uint16_t value)
+{
+	if(id >= CHECK_REGISTERS)
+		return ERROR_NO_DATAADDRESS;
+
+	registers[id] = value;
+	return ERROR_OK;
+}
+
+static int deviceinfo_calls = 0;
+
+static const char * check_readdeviceinfo(uint8_t object)
+{
+	deviceinfo_calls++;
+
+	switch(object)
+	{
+	case 0:    return "Nya";
+	case 1:    return "Check";
+	case 2:    return "v1";
+	case 0x80: return "Ext";
+	default:   return 0;
+	}
+}
+
+static enum_nyamodbus_error check_readcoils(uint16_t id, bool * result)
+{
+	*result = (id & 1) != 0;
+	return ERROR_OK;
+}
+
+static const str_modbus_io check_io = {
+	.send    = check_send,
+	.receive = 0
+};
+
+static str_nyamodbus_state check_state;
+static str_nyamodbus_rx    check_rx;
+static uint8_t             check_address = 0x11;
+
+static const str_nyamodbus_device check_modbus = {
+	.io    = &check_io,
+	.state = &check_state,
+	.rx    = &check_rx
+};
+
+static const str_nyamodbus_slave_device check_slave = {
+	.device         = &check_modbus,
+	.address        = &check_address,
+	.readholding    = check_readholding,
+	.writeholding   = check_writeholding,
+	.readcoils      = check_readcoils,
+	.readdeviceinfo = check_readdeviceinfo
+};
+
+// Send request and compare answer (without crc)
+//     name: check name
+//  request: request without crc
+//     size: request size
+// expected: expected answer without crc (0 - no answer)
+//    bytes: expected answer size
+static void check(const char * name, const uint8_t * request, uint8_t size, const uint8_t * expected, uint8_t bytes)
+{
+	uint8_t frame[NYAMODBUS_BUFFER_SIZE];
+	bool    ok;
+
+	reply_size = 0;
+	nyamodbus_rx_frame(&check_modbus, frame, nyamodbus_make_frame(frame, request, size));
+	nyamodbus_slave_main(&check_slave);
+
+	if(expected)
+		ok = (reply_size == bytes + 2) && (memcmp(reply, expected, bytes) == 0);
+	else
+		ok = (reply_size == 0);
+
+	if(!ok)
+		failed++;
+
+	printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+}
+
+int main(int argc, char *argv[])
+{
+	nyamodbus_slave_init(&check_slave);
+	registers[1] = 0x1234;
+
+	// Read holding
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_HOLDING, 0x00, 0x01, 0x00, 0x01 };
+		const uint8_t expected[] = { 0x11, FUNCTION_READ_HOLDING, 0x02, 0x12, 0x34 };
+		check("FC03 read", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// Count * 2 wraps to 0
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_HOLDING, 0x00, 0x00, 0x80, 0x00 };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_READ_HOLDING, ERROR_INV_REQ_VALUE };
+		check("FC03 count 0x8000", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// Above protocol limit
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_HOLDING, 0x00, 0x00, 0x00, 0x7E };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_READ_HOLDING, ERROR_INV_REQ_VALUE };
+		check("FC03 count 126", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// Above protocol limit (bits)
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_COIL, 0x00, 0x00, 0xFF, 0xFF };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_READ_COIL, ERROR_INV_REQ_VALUE };
+		check("FC01 count 0xFFFF", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// Read count is invalid: write must not be done
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READWRITE_HOLDING, 0x00, 0x00, 0x00, 0x7E, 0x00, 0x02, 0x00, 0x01, 0x02, 0xAB, 0xCD };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_READWRITE_HOLDING, ERROR_INV_REQ_VALUE };
+		check("FC23 read count 126", request, sizeof(request), expected, sizeof(expected));
+
+		if(registers[2] != 0)
+		{
+			puts("FC23 register is changed by invalid request");
+			failed++;
+		}
+	}
+
+	// Read address is not mapped: write must not be done
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READWRITE_HOLDING, 0x00, 0x20, 0x00, 0x01, 0x00, 0x02, 0x00, 0x01, 0x02, 0xAB, 0xCD };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_READWRITE_HOLDING, ERROR_NO_DATAADDRESS };
+		check("FC23 read address not mapped", request, sizeof(request), expected, sizeof(expected));
+
+		if(registers[2] != 0)
+		{
+			puts("FC23 register is changed by request with invalid read address");
+			failed++;
+		}
+	}
+
+	// Short frame: values must not be taken from crc and old buffer data
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_WRITE_HOLDING_SINGLE };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_WRITE_HOLDING_SINGLE, ERROR_INV_REQ_VALUE };
+		uint16_t before[CHECK_REGISTERS];
+
+		memcpy(before, registers, sizeof(registers));
+		check("FC06 4 byte frame", request, sizeof(request), expected, sizeof(expected));
+
+		if(memcmp(before, registers, sizeof(registers)) != 0)
+		{
+			puts("FC06 register is changed by short frame");
+			failed++;
+		}
+	}
+
+	// Short frame
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_HOLDING };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_READ_HOLDING, ERROR_INV_REQ_VALUE };
+		check("FC03 4 byte frame", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// Byte count is larger than frame
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_WRITE_HOLDING_MULTI, 0x00, 0x03, 0x00, 0x02, 0x04, 0x12, 0x34 };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_WRITE_HOLDING_MULTI, ERROR_INV_REQ_VALUE };
+		check("FC16 truncated data", request, sizeof(request), expected, sizeof(expected));
+
+		if(registers[3] != 0)
+		{
+			puts("FC16 register is changed by truncated frame");
+			failed++;
+		}
+	}
+
+	// Coil count does not match byte count
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_WRITE_COIL_MULTI, 0x00, 0x00, 0x00, 0x08, 0x02, 0xFF, 0xFF };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_WRITE_COIL_MULTI, ERROR_INV_REQ_VALUE };
+		check("FC15 extra data byte", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// No coils
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_WRITE_COIL_MULTI, 0x00, 0x00, 0x00, 0x00, 0x00 };
+		const uint8_t expected[] = { 0x11, 0x80 | FUNCTION_WRITE_COIL_MULTI, ERROR_INV_REQ_VALUE };
+		check("FC15 count 0", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	// Basic identification without cache: only basic objects are readed
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_DEVICE_IDENTIFICATION, 0x0E, 0x01, 0x00 };
+		const uint8_t expected[] = { 0x11, FUNCTION_READ_DEVICE_IDENTIFICATION, 0x0E, 0x01, 0x81, 0x00, 0x00, 0x03,
+		                             0x00, 0x03, 'N', 'y', 'a', 0x01, 0x05, 'C', 'h', 'e', 'c', 'k', 0x02, 0x02, 'v', '1' };
+		deviceinfo_calls = 0;
+		check("FC43 basic without cache", request, sizeof(request), expected, sizeof(expected));
+
+		if(deviceinfo_calls > 4)
+		{
+			printf("FC43 readdeviceinfo is called %d times\n", deviceinfo_calls);
+			failed++;
+		}
+	}
+
+	// Individual access to extended object
+	{
+		const uint8_t request[]  = { 0x11, FUNCTION_READ_DEVICE_IDENTIFICATION, 0x0E, 0x04, 0x80 };
+		const uint8_t expected[] = { 0x11, FUNCTION_READ_DEVICE_IDENTIFICATION, 0x0E, 0x04, 0x83, 0x00, 0x00, 0x01, 0x80, 0x03, 'E', 'x', 't' };
+		check("FC43 individual object", request, sizeof(request), expected, sizeof(expected));
+	}
+
+	printf("Failed: %d\n", failed);
+	return (failed == 0) ? 0 : 1;
+}
@@ -44,16 +44,20 @@ const char * emu_readdeviceinfo(uint8_t object)
 // Slave id
 static uint8_t slave_address = 0x11;
 static str_nyamodbus_state state;
+static str_nyamodbus_rx    rx;
 
+// Requests are added to rx ring by emulator
 static const str_modbus_io io = {
 	.send           = emu_slave_send,
-	.receive        = emu_slave_receive
+	.receive        = 0,
+	.echo           = EMU_ECHO
 };
 
 // Modbus slave state
 static const str_nyamodbus_device modbus_slave = {
 	.io =    &io,
-	.state = &state
+	.state = &state,
+	.rx    = &rx
 };
 
 const str_nyamodbus_slave_device emucontacts = {
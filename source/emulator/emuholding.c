@@ -11,37 +11,15 @@
 
 uint16_t holding[REG_COUNT];
 
-// Read holding registers
-//     id: index of register
-//  value: where to write value 
-// return: error code
-static enum_nyamodbus_error read_holding(uint16_t id, uint16_t * value)
-{
-	if((id > 0) && (id <= REG_COUNT))
-	{
-		*value = holding[id - 1];
-		
-		return ERROR_OK;
-	}
-	else
-		return ERROR_NO_DATAADDRESS;
-}
+// Holding registers map (registers 1..REG_COUNT)
+static const str_nyamodbus_regmap_range holding_ranges[] = {
+	{ .start = 1, .count = REG_COUNT, .data = holding, .flags = REGMAP_READWRITE }
+};
 
-// Write holding registers
-//     id: index of register
-//  value: where to write value 
-// return: error code
-static enum_nyamodbus_error write_holding(uint16_t id, uint16_t value)
-{
-	if((id > 0) && (id <= REG_COUNT))
-	{
-		holding[id - 1] = value;
-		
-		return ERROR_OK;
-	}
-	else
-		return ERROR_NO_DATAADDRESS;
-}
+static const str_nyamodbus_regmap holding_map = {
+	.ranges = holding_ranges,
+	.count  = sizeof(holding_ranges) / sizeof(holding_ranges[0])
+};
 
 // Get device id string
 // object: object id
@@ -64,16 +42,20 @@ const char * emu_readdeviceinfo(uint8_t object)
 // Slave id
 static uint8_t slave_address = 0x11;
 static str_nyamodbus_state state;
+static str_nyamodbus_rx    rx;
 
+// Requests are added to rx ring by emulator
 static const str_modbus_io io = {
 	.send           = emu_slave_send,
-	.receive        = emu_slave_receive
+	.receive        = 0,
+	.echo           = EMU_ECHO
 };
 
 // Modbus slave state
 static const str_nyamodbus_device modbus_slave = {
 	.io =    &io,
-	.state = &state
+	.state = &state,
+	.rx    = &rx
 };
 
 const str_nyamodbus_slave_device emuholding = {
@@ -84,6 +66,7 @@ const str_nyamodbus_slave_device emuholding = {
 	.readanalog     = 0,
 	.readcoils      = 0,
 	.writecoil      = 0,
-	.readholding    = read_holding,
-	.writeholding   = write_holding
+	.readholding    = 0,
+	.writeholding   = 0,
+	.holdingmap     = &holding_map
 };
@@ -7,23 +7,30 @@
 #include "emulator.h"
 #include <nyamodbus/nyamodbus_utils.h>
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 
+// Emulator link: frames are added to rx ring of receiving device (ring has one producer: senders are serialized by lock)
 typedef struct
 {
-	uint8_t data[100];
-	uint8_t index;
-	uint8_t size;
-} str_emu_buffer;
+	// Receiving device
+	const str_nyamodbus_device * device;
+	// Wake up of receiving thread (eventfd)
+	int                          event;
+	// Lock of senders (master sends from application and master threads)
+	pthread_mutex_t              lock;
+} str_emu_link;
 
-// Master->slave buffer
-str_emu_buffer master_slave;
+// Master->slave link
+static str_emu_link master_slave = { .device = 0, .event = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
 
-// Slave->master buffer
-str_emu_buffer slave_master;
+// Slave->master link
+static str_emu_link slave_master = { .device = 0, .event = -1, .lock = PTHREAD_MUTEX_INITIALIZER };
 
 // Emulator device
 static const str_nyamodbus_slave_device * emu_device = 0;
@@ -31,11 +38,8 @@ static const str_nyamodbus_slave_device * emu_device = 0;
 // Thread control
 static pthread_t                          emu_thread_id;
 
-// Thread mutex                         
-static pthread_mutex_t                    emu_data_mutex;
-
 // Is emulator runnung                  
-static bool                               emu_running = false;
+static volatile bool                      emu_running = false;
 
 // Get current timestamp
 uint64_t get_timestamp(void)
@@ -46,102 +50,102 @@ uint64_t get_timestamp(void)
 	return tv.tv_sec*1000000ULL + tv.tv_usec;
 }
 
-// Reset buffer to default state
-static void buffer_reset(str_emu_buffer * buffer)
+// Connect receiving device to link
+//   link: link to work with
+// device: receiving device (0 - data is dropped)
+// return: false, if device has no rx ring (data is dropped)
+static bool emu_link_attach(str_emu_link * link, const str_nyamodbus_device * device)
 {
-	pthread_mutex_lock(&emu_data_mutex);
-	memset(buffer, 0, sizeof(str_emu_buffer));
-	pthread_mutex_unlock(&emu_data_mutex);
+	if(device && !device->rx)
+	{
+		puts("Emulator device has no rx ring");
+		device = 0;
+	}
+	
+	if(link->event < 0)
+		link->event = eventfd(0, EFD_NONBLOCK);
+	
+	__atomic_store_n(&link->device, device, __ATOMIC_RELEASE);
+	return (device != 0);
 }
 
-// Receive emulator modbus data
-// buffer: buffer to work with
-//   data: data to read
-//   size: size of buffer, size of readed data if result is true
-// return: true, if ok
-static bool emu_receive_buffer(str_emu_buffer * buffer, uint8_t * data, uint8_t * size)
+// Wake up receiving thread
+//   link: link to work with
+static void emu_link_wake(str_emu_link * link)
 {
-	uint8_t tosend;
-	pthread_mutex_lock(&emu_data_mutex);
+	uint64_t value = 1;
 	
-	tosend = buffer->size - buffer->index;
-	if(tosend > 0)
+	if(link->event >= 0)
 	{
-		if(*size < tosend) 
-			tosend = *size;
-		
-		memcpy(data, &buffer->data[buffer->index], tosend);
-		*size = tosend;
-		buffer->index += tosend;
-		
-		if(buffer->index == buffer->size)
-		{
-			buffer->index = 0;
-			buffer->size = 0;
-		}
+		if(write(link->event, &value, sizeof(value)) != sizeof(value))
+			return;
 	}
-	else
-		*size = 0;
-	
-	pthread_mutex_unlock(&emu_data_mutex);
 }
 
-// Is emulator buffer busy
-static bool emu_is_buffer_busy(str_emu_buffer * buffer)
+// Wait data in link
+//   link: link to work with
+//     ms: max time to wait
+static void emu_link_wait(str_emu_link * link, int ms)
 {
-	bool busy = false;
-	pthread_mutex_lock(&emu_data_mutex);
-	busy = (buffer->size != 0);
-	pthread_mutex_unlock(&emu_data_mutex);
+	struct pollfd fd = { .fd = link->event, .events = POLLIN };
+	uint64_t value;
 	
-	return busy;
+	if(poll(&fd, 1, ms) > 0)
+	{
+		if(read(link->event, &value, sizeof(value)) != sizeof(value))
+			return;
+	}
 }
 
-// Wait tx to free
-static void emu_wait_buffer(str_emu_buffer * buffer)
+// Send data to link
+//   link: link to work with
+//   data: data to send
+//   size: size of data
+// return: true, if ok
+static bool emu_link_send(str_emu_link * link, const uint8_t * data, uint8_t size)
 {
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
-	bool busy = false;
-#endif
+	const str_nyamodbus_device * device;
 	
-	while(emu_is_buffer_busy(buffer))
+	pthread_mutex_lock(&link->lock);
+	
+	device = __atomic_load_n(&link->device, __ATOMIC_ACQUIRE);
+	while(device && !nyamodbus_rx_frame(device, data, size))
 	{
-		usleep(1000);
+		// Ring is full: wait receiving thread
+		emu_link_wake(link);
+		sched_yield();
 		
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
-		printf(".");
-		busy = true;
-#endif
+		device = __atomic_load_n(&link->device, __ATOMIC_ACQUIRE);
 	}
 	
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
-	if(busy) puts(".");
-#endif
+	pthread_mutex_unlock(&link->lock);
+	
+	if(!device)
+		return false;
+	
+	emu_link_wake(link);
+	return true;
 }
 
-// Send data to buffer
-// buffer: buffer to work with
+#if EMU_ECHO
+// Send echo to link without wait (sender is receiving thread: full ring is not processed while waiting)
+//   link: link to work with
 //   data: data to send
 //   size: size of data
-// return: true, if ok
-void emu_send_buffer(str_emu_buffer * buffer, const uint8_t * data, uint8_t size)
+static void emu_link_echo(str_emu_link * link, const uint8_t * data, uint8_t size)
 {
-	emu_wait_buffer(buffer);
-	if(size <= sizeof(buffer->data))
-	{
-		pthread_mutex_lock(&emu_data_mutex);
-		memcpy(&buffer->data[0], data, size);
-		buffer->size = size;
-		
-		pthread_mutex_unlock(&emu_data_mutex);
-	}
-	else
-	{
-		printf("Message is too big for internal buffer: %u > %lu\n", size, sizeof(buffer->data));
-	}
+	const str_nyamodbus_device * device;
 	
-	emu_wait_buffer(buffer);
+	pthread_mutex_lock(&link->lock);
+	
+	// Echo is lost, if ring is full
+	device = __atomic_load_n(&link->device, __ATOMIC_ACQUIRE);
+	if(device)
+		nyamodbus_rx_frame(device, data, size);
+	
+	pthread_mutex_unlock(&link->lock);
 }
+#endif
 
 // Main emulator processing thread
 static void * emu_thread(void * args)
@@ -160,14 +164,14 @@ static void * emu_thread(void * args)
 		nyamodbus_slave_main(emu_device);
 		
 		emu_timestamp = time;
-		usleep(10000);
+		emu_link_wait(&master_slave, EMU_IDLE_TIMEOUT);
 	}
 	
 	puts("Emulator is stopped");
 	return 0;
 }
 
-// Start device emulation
+// Start device emulation (requests are added to rx ring, device without rx is not started)
 // device: device info
 void emu_start(const str_nyamodbus_slave_device * device)
 {
@@ -175,8 +179,9 @@ void emu_start(const str_nyamodbus_slave_device * device)
 	{
 		pthread_attr_t attr;
 		
-		buffer_reset(&master_slave);
-		buffer_reset(&slave_master);
+		// Requests are added to rx ring of device
+		if(!emu_link_attach(&master_slave, device->device))
+			return;
 		
 		emu_device = device;
 		emu_running = true;
@@ -189,14 +194,14 @@ void emu_start(const str_nyamodbus_slave_device * device)
 // Stop device emulation
 void emu_stop()
 {
+	if(!emu_running)
+		return;
+	
 	emu_running = false;
+	emu_link_wake(&master_slave);
 	pthread_join(emu_thread_id, 0);
-}
-
-// Wait tx to free
-static void remu_wait(void)
-{
-	emu_wait_buffer(&master_slave);
+	
+	emu_link_attach(&master_slave, 0);
 }
 
 // Send data to emulator
@@ -205,8 +210,7 @@ static void remu_wait(void)
 // return: true, if ok
 void emu_send(const uint8_t * data, uint8_t size)
 {
-	emu_send_buffer(&master_slave, data, size);
-	nyamodbus_slave_timeout(emu_device);
+	emu_link_send(&master_slave, data, size);
 }
 
 // Dump buffer
@@ -233,47 +237,53 @@ void emu_dump_buffer(const char * name, const uint8_t * data, uint8_t size)
 bool emu_slave_send(const uint8_t * data, uint8_t size)
 {
 	emu_dump_buffer("slave send", data, size);
-	emu_send_buffer(&slave_master, data, size);
 	
-	return true;
-}
-
-// Receive slave emulator modbus data
-//   data: data to read
-//   size: size of buffer, size of readed data if result is true
-// return: true, if ok
-bool emu_slave_receive(uint8_t * data, uint8_t * size)
-{
-	emu_receive_buffer(&master_slave, data, size);
-	
-	if(*size > 0)
-	    emu_dump_buffer("slave received", data, *size);
+#if EMU_ECHO
+	// Echo is received before answer reaches master
+	emu_link_echo(&master_slave, data, size);
+#endif
 	
-	return (*size > 0);
+	return emu_link_send(&slave_master, data, size);
 }
 
-// Send slave emulator modbus data
+// Send master emulator modbus data
 //   data: data to send
 //   size: size of data
 // return: true, if ok
 bool emu_master_send(const uint8_t * data, uint8_t size)
 {
 	emu_dump_buffer("master send", data, size);
-	emu_send_buffer(&master_slave, data, size);
 	
-	return true;
+#if EMU_ECHO
+	// Echo is received before request reaches slave
+	emu_link_echo(&slave_master, data, size);
+#endif
+	
+	return emu_link_send(&master_slave, data, size);
 }
 
-// Receive slave emulator modbus data
-//   data: data to read
-//   size: size of buffer, size of readed data if result is true
-// return: true, if ok
-bool emu_master_receive(uint8_t * data, uint8_t * size)
+// Connect master device to emulator (slave answers are added to device->rx)
+// device: master device
+void emu_master_attach(const str_nyamodbus_device * device)
 {
-	emu_receive_buffer(&slave_master, data, size);
-	
-	if(*size > 0)
-		emu_dump_buffer("master received", data, *size);
-	
-	return (*size > 0);
+	emu_link_attach(&slave_master, device);
+}
+
+// Disconnect master device from emulator
+void emu_master_detach(void)
+{
+	emu_link_attach(&slave_master, 0);
+}
+
+// Wait slave answer or other event for master thread
+//     ms: max time to wait
+void emu_master_wait(int ms)
+{
+	emu_link_wait(&slave_master, ms);
+}
+
+// Wake up master thread (new request is queued)
+void emu_master_wake(void)
+{
+	emu_link_wake(&slave_master);
 }
@@ -11,13 +11,15 @@
 	#include <nyamodbus/nyamodbus.h>
 	#include <nyamodbus/nyamodbus_slave.h>
 
+	// Sent frames are received back by sender (half-duplex RS-485 adapter), io of devices skips echo
+	#ifndef EMU_ECHO
+		#define EMU_ECHO 0
+	#endif
+
 #ifdef EMULATOR_INTERNAL
 
-	// Receive slave emulator modbus data
-	//   data: data to read
-	//   size: size of buffer, size of readed data if result is true
-	// return: true, if ok
-	bool emu_slave_receive(uint8_t * data, uint8_t * size);
+	// Max time to wait data in emulator threads (ms), timers are processed after it
+	#define EMU_IDLE_TIMEOUT 1
 
 	// Send slave emulator modbus data
 	//   data: data to send
@@ -25,31 +27,39 @@
 	// return: true, if ok
 	bool emu_slave_send(const uint8_t * data, uint8_t size);
 	
-	// Receive master emulator modbus data
-	//   data: data to read
-	//   size: size of buffer, size of readed data if result is true
-	// return: true, if ok
-	bool emu_master_receive(uint8_t * data, uint8_t * size);
-
 	// Send master emulator modbus data
 	//   data: data to send
 	//   size: size of data
 	// return: true, if ok
 	bool emu_master_send(const uint8_t * data, uint8_t size);
 	
+	// Connect master device to emulator (slave answers are added to device->rx)
+	// device: master device
+	void emu_master_attach(const str_nyamodbus_device * device);
+	
+	// Disconnect master device from emulator
+	void emu_master_detach(void);
+	
+	// Wait slave answer or other event for master thread
+	//     ms: max time to wait
+	void emu_master_wait(int ms);
+	
+	// Wake up master thread (new request is queued)
+	void emu_master_wake(void);
+	
 #endif
 
 	// Get current timestamp
 	uint64_t get_timestamp(void);
 
-	// Start device emulation
+	// Start device emulation (requests are added to rx ring, device without rx is not started)
 	// device: device info
 	void emu_start(const str_nyamodbus_slave_device * device);
 
 	// Stop device emulation
 	void emu_stop();
 
-	// Send data to emulator
+	// Send data to emulator (must not be mixed with requests of master emulator)
 	//   data: data to send
 	//   size: size of data
 	// return: true, if ok
@@ -10,20 +10,23 @@
 #include <pthread.h>
 #include <string.h>
 #include <stdio.h>
-#include <unistd.h>
 
 static str_nyamodbus_state state;
 static str_nyamodbus_master_state master_state;
+static str_nyamodbus_rx rx;
 
+// Answers are added to rx ring by emulator
 static const str_modbus_io io = {
 	.send           = emu_master_send,
-	.receive        = emu_master_receive
+	.receive        = 0,
+	.echo           = EMU_ECHO
 };
 
 // Modbus slave state
 static const str_nyamodbus_device modbus_master = {
 	.io =    &io,
-	.state = &state
+	.state = &state,
+	.rx    = &rx
 };
 
 static void master_error_cb(uint8_t slave, enum_nyamodbus_error error);
@@ -32,9 +35,16 @@ static void master_read_coils_cb(uint8_t slave, uint16_t index, bool value);
 static void master_read_inputs_cb(uint8_t slave, uint16_t index, uint16_t value);
 static void master_read_holding_cb(uint8_t slave, uint16_t index, uint16_t value);
 
+// Slaves with adaptive timeouts
+static str_nyamodbus_master_slave master_slaves[] = {
+	{ .address = 0x11 }
+};
+
 static const str_nyamodbus_master_device master = {
 	.device        = &modbus_master,
 	.state         = &master_state,
+	.slaves        = master_slaves,
+	.slave_count   = sizeof(master_slaves) / sizeof(master_slaves[0]),
 	.on_error      = master_error_cb,
 	.read_contacts = master_read_contacts_cb,
 	.read_coils    = master_read_coils_cb,
@@ -45,6 +55,12 @@ static const str_nyamodbus_master_device master = {
 // Timestamp to calc timeouts
 static uint64_t                           emu_timestamp = 0;
 
+// Count of values from read callbacks
+static uint32_t                           master_values = 0;
+
+// Count of modbus errors
+static uint32_t                           master_errors = 0;
+
 // Thread control
 static pthread_t                          emu_master_thread_id;
 
@@ -57,6 +73,7 @@ static void master_init(void)
 	emu_timestamp = get_timestamp();
 	
 	nyamodbus_master_init(&master);
+	emu_master_attach(&modbus_master);
 }
 
 // Master loop
@@ -79,9 +96,10 @@ static void * emu_master_thread(void * args)
 	while(emu_master_running)
 	{
 		master_main();
-		usleep(10000);
+		emu_master_wait(EMU_IDLE_TIMEOUT);
 	}
 	
+	emu_master_detach();
 	puts("Master (EMU) is stopped");
 	return 0;
 }
@@ -104,36 +122,42 @@ void master_start(void)
 void master_stop(void)
 {
 	emu_master_running = false;
+	emu_master_wake();
 	pthread_join(emu_master_thread_id, 0);
 }
 
 // On modbus error
 static void master_error_cb(uint8_t slave, enum_nyamodbus_error error)
 {
+	__atomic_add_fetch(&master_errors, 1, __ATOMIC_RELAXED);
 	printf("ERROR: %d", error);
 }
 
 // Read contacts callback
 static void master_read_contacts_cb(uint8_t slave, uint16_t index, bool value)
 {
+	__atomic_add_fetch(&master_values, 1, __ATOMIC_RELAXED);
 	printf("CONTACT %03d: %d", index, value ? 1 : 0);
 }
 
 // Read coils callback
 static void master_read_coils_cb(uint8_t slave, uint16_t index, bool value)
 {
+	__atomic_add_fetch(&master_values, 1, __ATOMIC_RELAXED);
 	printf("COIL %03d: %d", index, value ? 1 : 0);
 }
 
 // Read analog inputs
 static void master_read_inputs_cb(uint8_t slave, uint16_t index, uint16_t value)
 {
+	__atomic_add_fetch(&master_values, 1, __ATOMIC_RELAXED);
 	printf("INPUT %03d: %04x", index, value);
 }
 
 // Read holding registers
 static void master_read_holding_cb(uint8_t slave, uint16_t index, uint16_t value)
 {
+	__atomic_add_fetch(&master_values, 1, __ATOMIC_RELAXED);
 	printf("HOLDING %03d: %04x", index, value);
 }
 
@@ -145,6 +169,7 @@ static void master_read_holding_cb(uint8_t slave, uint16_t index, uint16_t value
 void master_read_coils(uint8_t slave, uint16_t index, uint16_t count)
 {
 	nyamodbus_read_coils(&master, slave, index, count);
+	emu_master_wake();
 }
 
 // Read contacts
@@ -154,6 +179,7 @@ void master_read_coils(uint8_t slave, uint16_t index, uint16_t count)
 void master_read_contacts(uint8_t slave, uint16_t index, uint16_t count)
 {
 	nyamodbus_read_contacts(&master, slave, index, count);
+	emu_master_wake();
 }
 
 // Read holding
@@ -163,6 +189,7 @@ void master_read_contacts(uint8_t slave, uint16_t index, uint16_t count)
 void master_read_holdings(uint8_t slave, uint16_t index, uint16_t count)
 {
 	nyamodbus_read_holdings(&master, slave, index, count);
+	emu_master_wake();
 }
 
 // Read inputs
@@ -172,5 +199,15 @@ void master_read_holdings(uint8_t slave, uint16_t index, uint16_t count)
 void master_read_inputs(uint8_t slave, uint16_t index, uint16_t count)
 {
 	nyamodbus_read_inputs(&master, slave, index, count);
+	emu_master_wake();
+}
+
+// Get counters of master
+// values: count of values from read callbacks
+// errors: count of modbus errors
+void master_get_counters(uint32_t * values, uint32_t * errors)
+{
+	*values = __atomic_load_n(&master_values, __ATOMIC_RELAXED);
+	*errors = __atomic_load_n(&master_errors, __ATOMIC_RELAXED);
 }
 
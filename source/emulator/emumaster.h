@@ -38,5 +38,10 @@
 	//  count: input count
 	void master_read_inputs(uint8_t slave, uint16_t index, uint16_t count);
 
+	// Get counters of master
+	// values: count of values from read callbacks
+	// errors: count of modbus errors
+	void master_get_counters(uint32_t * values, uint32_t * errors);
+
 
 #endif
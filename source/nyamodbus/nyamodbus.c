@@ -7,6 +7,24 @@
 #include <string.h>
 #include <stdio.h>
 
+// Counters have one writer: plain increment without lock, readers never see torn value
+#if defined(__GNUC__)
+	#define STATS_LOAD(ptr)        __atomic_load_n(ptr, __ATOMIC_RELAXED)
+	#define STATS_STORE(ptr, v)    __atomic_store_n(ptr, v, __ATOMIC_RELAXED)
+#else
+	#define STATS_LOAD(ptr)        (*(volatile uint16_t *)(ptr))
+	#define STATS_STORE(ptr, v)    (*(volatile uint16_t *)(ptr) = (v))
+#endif
+
+// Receive ring counters: one producer (interrupt), one consumer (main)
+#if defined(__GNUC__)
+	#define RX_LOAD(ptr)           __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+	#define RX_STORE(ptr, v)       __atomic_store_n(ptr, v, __ATOMIC_RELEASE)
+#else
+	#define RX_LOAD(ptr)           (*(volatile uint16_t *)(ptr))
+	#define RX_STORE(ptr, v)       (*(volatile uint16_t *)(ptr) = (v))
+#endif
+
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
 void dump_array(const char * name, const uint8_t * data, uint16_t size)
 {
@@ -48,6 +66,7 @@ void nyamodbus_init(const str_nyamodbus_device * device)
 	
 #endif
 
+	memset(&device->state->echo, 0, sizeof(str_nyamodbus_echo));
 	nyamodbus_reset(device);
 }
 
@@ -58,13 +77,51 @@ void nyamodbus_reset(const str_nyamodbus_device * device)
 	puts("nyamodbus_reset");
 #endif
 
+	// Echo of answer is received after reset
+	str_nyamodbus_echo echo = device->state->echo;
+	
 	// Init buffer...
 	memset(device->state, 0, sizeof(str_nyamodbus_state));
+	device->state->echo = echo;
 	
 	device->state->has_data = false;
 	device->state->buffer.size = NYAMODBUS_BUFFER_SIZE;
 }
 
+// Increment diagnostic counter (modbus thread)
+// device: device context
+//   stat: counter
+void nyamodbus_stats_count(const str_nyamodbus_device * device, enum_nyamodbus_stat stat)
+{
+	if(device->stats)
+	{
+		uint16_t * counter = &device->stats->counters[stat];
+		
+		STATS_STORE(counter, (uint16_t)(STATS_LOAD(counter) + 1));
+	}
+}
+
+// Get diagnostic counter (any thread)
+// device: device context
+//   stat: counter
+// return: counter value (0 if statistics block is not set)
+uint16_t nyamodbus_stats_get(const str_nyamodbus_device * device, enum_nyamodbus_stat stat)
+{
+	return device->stats ? STATS_LOAD(&device->stats->counters[stat]) : 0;
+}
+
+// Clear diagnostic counters (modbus thread)
+// device: device context
+void nyamodbus_stats_clear(const str_nyamodbus_device * device)
+{
+	if(device->stats)
+	{
+		uint8_t i;
+		for(i = 0; i < STAT_COUNT; i++)
+			STATS_STORE(&device->stats->counters[i], 0);
+	}
+}
+
 // Calc crc16
 //   data: packet data
 //   size: packet size without crc
@@ -101,7 +158,6 @@ static uint16_t nyamodbus_crc(const uint8_t *data, uint8_t size)
 // size: data size
 void nyamodbus_send_packet(const str_nyamodbus_device * device, const uint8_t * data, uint8_t size)
 {
-	uint16_t crc = nyamodbus_crc(data, size);
 	uint8_t result[NYAMODBUS_OUTPUT_BUFFER_SIZE];
 	
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
@@ -109,10 +165,93 @@ void nyamodbus_send_packet(const str_nyamodbus_device * device, const uint8_t *
 	dump_array("Sended:", data, size);
 #endif
 
-	memcpy(result, data, size);
-	set_u16_value(result, size, crc);
+	nyamodbus_send_frame(device, result, nyamodbus_make_frame(result, data, size));
+}
+
+// Make frame: data with crc
+//  frame: result [size + 2]
+//   data: data without crc
+//   size: data size
+// return: frame size
+uint8_t nyamodbus_make_frame(uint8_t * frame, const uint8_t * data, uint8_t size)
+{
+	uint16_t crc = nyamodbus_crc(data, size);
+	
+	if(frame != data)
+		memcpy(frame, data, size);
+	
+	set_u16_value(frame, size, crc);
+	return size + 2;
+}
+
+// Send prepared frame
+// device: device context
+//  frame: data with crc
+//   size: frame size
+void nyamodbus_send_frame(const str_nyamodbus_device * device, const uint8_t * frame, uint8_t size)
+{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
+	printf(" Send frame with size %d\n", size);
+	dump_array("Sended:", frame, size);
+#endif
+
+	if(device->io->echo && (size <= NYAMODBUS_OUTPUT_BUFFER_SIZE))
+	{
+		str_nyamodbus_echo * echo = &device->state->echo;
+		
+		memcpy(echo->data, frame, size);
+		echo->size       = size;
+		echo->matched    = 0;
+		echo->elapsed_us = 0;
+	}
+	
+	device->io->send(frame, size);
+}
+
+// Skip echo of sent frame
+// device: device context
+//   data: received bytes
+//   size: byte count
+// return: count of echo bytes at start of data
+static uint16_t nyamodbus_echo_skip(const str_nyamodbus_device * device, const uint8_t * data, uint16_t size)
+{
+	str_nyamodbus_echo * echo = &device->state->echo;
+	uint16_t count = echo->size - echo->matched;
+	uint16_t i = 0;
+	
+	if(echo->size == 0)
+		return 0;
+	
+	if(count > size)
+		count = size;
+	
+	if(memcmp(data, &echo->data[echo->matched], count) == 0)
+	{
+		i = count;
+		echo->matched   += count;
+		echo->elapsed_us = 0;
+	}
+	else
+	{
+		// Other bytes after echo
+		while(data[i] == echo->data[echo->matched + i])
+			i++;
+		
+		echo->matched = echo->size;
+	}
+	
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
+	if(i > 0)
+		printf(" Skip %d echo bytes\n", i);
+#endif
 	
-	device->io->send(result, size + 2);
+	if(echo->matched >= echo->size)
+	{
+		echo->size    = 0;
+		echo->matched = 0;
+	}
+	
+	return i;
 }
 
 // Check packet crc
@@ -134,15 +273,33 @@ static bool nyamodbus_checkcrc(const uint8_t * data, uint8_t size)
 }
 
 // Process byte
-// device: device context
-//   byte: received byte
-static void nyamodbus_processbyte(const str_nyamodbus_device * device, uint8_t byte)
+//  device: device context
+//  driver: functions to process packets
+// context: driver context
+//    byte: received byte
+static void nyamodbus_processbyte(const str_nyamodbus_device * device, const str_nyamodbus_driver * driver, void * context, uint8_t byte)
 {
 	str_nyamodbus_buffer * buffer = &device->state->buffer;
+	
+	if(device->state->skip)
+		return;
+	
+	// Packet for other device: skip until silence
+	if((buffer->added == 0) && driver->accept_address && !driver->accept_address(context, byte))
+	{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
+		printf("  Skip packet for %02x\n", byte);
+#endif
+		device->state->skip = true;
+		return;
+	}
+	
 	if(buffer->added < NYAMODBUS_BUFFER_SIZE)
 	{
 		buffer->data[buffer->added++] = byte;
 	}
+	else
+		device->state->overrun = true;
 }
 
 // Is busy
@@ -152,6 +309,141 @@ bool nyamodbus_is_busy(const str_nyamodbus_device * device)
 	return device->state->busy;
 }
 
+// Is device still sending data
+// device: device context
+bool nyamodbus_is_txbusy(const str_nyamodbus_device * device)
+{
+	return device->io->is_txbusy && device->io->is_txbusy();
+}
+
+// Is address broadcast (0 by specification, 255 is accepted too)
+// address: slave address
+bool nyamodbus_is_broadcast(uint8_t address)
+{
+	return (address == 0) || (address == 255);
+}
+
+// Process bytes from interrupt receive ring
+//  device: device context
+//  driver: functions to process packets
+// context: driver context
+static void nyamodbus_rx_process(const str_nyamodbus_device * device, const str_nyamodbus_driver * driver, void * context)
+{
+	str_nyamodbus_rx * rx = device->rx;
+	uint16_t tail = rx->tail;
+	
+	for(;;)
+	{
+		bool     ended = (rx->end_tail != RX_LOAD(&rx->end_head));
+		uint16_t limit = ended ? rx->ends[rx->end_tail & (NYAMODBUS_RX_FRAME_COUNT - 1)] : RX_LOAD(&rx->head);
+		
+		if(tail != limit)
+		{
+			bool received = false;
+			
+			while(tail != limit)
+			{
+				uint8_t byte = rx->data[tail & (NYAMODBUS_RX_RING_SIZE - 1)];
+				
+				tail++;
+				if(nyamodbus_echo_skip(device, &byte, 1) > 0)
+					continue;
+				
+				if(!received && driver->on_data)
+					driver->on_data(context);
+				
+				received = true;
+				nyamodbus_processbyte(device, driver, context, byte);
+			}
+			
+			RX_STORE(&rx->tail, tail);
+		}
+		
+		if(!ended)
+			break;
+		
+		RX_STORE(&rx->end_tail, (uint16_t)(rx->end_tail + 1));
+		
+		// Frame is complete: parse without silence timeout
+		if((device->state->buffer.added > 0) || device->state->skip || device->state->overrun)
+		{
+			nyamodbus_timeout(device, driver, context);
+			device->state->busy = false;
+		}
+	}
+}
+
+// Add received bytes to interrupt receive ring
+//     rx: receive ring
+//   data: bytes
+//   size: byte count
+// return: false, if there is no space (nothing is added)
+static bool nyamodbus_rx_push(str_nyamodbus_rx * rx, const uint8_t * data, uint16_t size)
+{
+	uint16_t head = rx->head;
+	uint16_t i;
+	
+	if((uint16_t)(head - RX_LOAD(&rx->tail)) + size > NYAMODBUS_RX_RING_SIZE)
+		return false;
+	
+	for(i = 0; i < size; i++)
+		rx->data[(uint16_t)(head + i) & (NYAMODBUS_RX_RING_SIZE - 1)] = data[i];
+	
+	// Bytes are visible to main before counter
+	RX_STORE(&rx->head, (uint16_t)(head + size));
+	return true;
+}
+
+// Add received byte (interrupt safe, one producer)
+// device: device context
+//   byte: received byte
+// return: false, if ring is full or device has no rx ring (byte is lost)
+bool nyamodbus_rx_byte(const str_nyamodbus_device * device, uint8_t byte)
+{
+	if(!device->rx)
+		return false;
+	
+	return nyamodbus_rx_push(device->rx, &byte, 1);
+}
+
+// Mark end of frame (interrupt safe, one producer): frame is parsed without silence timeout (idle line)
+// device: device context
+// return: false, if there are too many frame ends or device has no rx ring
+bool nyamodbus_rx_frame_end(const str_nyamodbus_device * device)
+{
+	str_nyamodbus_rx * rx = device->rx;
+	uint16_t end_head;
+	
+	if(!rx)
+		return false;
+	
+	end_head = rx->end_head;
+	if((uint16_t)(end_head - RX_LOAD(&rx->end_tail)) >= NYAMODBUS_RX_FRAME_COUNT)
+		return false;
+	
+	rx->ends[end_head & (NYAMODBUS_RX_FRAME_COUNT - 1)] = rx->head;
+	RX_STORE(&rx->end_head, (uint16_t)(end_head + 1));
+	return true;
+}
+
+// Add received frame (interrupt safe, one producer): bytes and end of frame (DMA)
+// device: device context
+//   data: frame data
+//   size: frame size
+// return: false, if there is no space or device has no rx ring (frame is lost)
+bool nyamodbus_rx_frame(const str_nyamodbus_device * device, const uint8_t * data, uint16_t size)
+{
+	str_nyamodbus_rx * rx = device->rx;
+	
+	if(!rx)
+		return false;
+	
+	if((uint16_t)(rx->end_head - RX_LOAD(&rx->end_tail)) >= NYAMODBUS_RX_FRAME_COUNT)
+		return false;
+	
+	return nyamodbus_rx_push(rx, data, size) && nyamodbus_rx_frame_end(device);
+}
+
 // Main processing cycle
 // device: device context
 void nyamodbus_main(const str_nyamodbus_device * device, const str_nyamodbus_driver * driver, void * context)
@@ -162,15 +454,20 @@ void nyamodbus_main(const str_nyamodbus_device * device, const str_nyamodbus_dri
 	if(device->io->is_txbusy)
 	{
 		if(device->io->is_txbusy())
+		{
 			nyamodbus_reset_timeout(device);
+			device->state->echo.elapsed_us = 0;
+		}
 	}
 	
 	// If something is available to receive...
 	if(device->io->receive && device->io->receive(buffer, &size))
 	{
-		if(size > 0)
+		// Echo of sent frame is skipped
+		uint8_t i = nyamodbus_echo_skip(device, buffer, size);
+		
+		if(size > i)
 		{
-			uint8_t i;
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			printf("Readed %d bytes\n", size);
 #endif
@@ -178,12 +475,16 @@ void nyamodbus_main(const str_nyamodbus_device * device, const str_nyamodbus_dri
 			if(driver->on_data)
 				driver->on_data(context);
 
-			for(i = 0; i < size; i++)
+			for(; i < size; i++)
 			{
-				nyamodbus_processbyte(device, buffer[i]);
+				nyamodbus_processbyte(device, driver, context, buffer[i]);
 			}
 		}
 	}
+	
+	// Bytes from interrupt
+	if(device->rx)
+		nyamodbus_rx_process(device, driver, context);
 }
 
 // Trigger modbus timeout (parse received data)
@@ -194,17 +495,29 @@ void nyamodbus_timeout(const str_nyamodbus_device * device, const str_nyamodbus_
 {
 	str_nyamodbus_buffer * buffer = &device->state->buffer;
 	
-	if(buffer->added > 4)
+	if(device->state->overrun)
+		nyamodbus_stats_count(device, STAT_OVERRUNS);
+	
+	if(device->state->skip)
+	{
+		// Skipped packet: nothing to check
+		nyamodbus_stats_count(device, STAT_BUS_MESSAGES);
+	}
+	else if(buffer->added >= 4) // shortest frame: request without data (FC07, FC17), driver checks size
 	{
 		uint8_t size = buffer->added;
 		
 		if(nyamodbus_checkcrc(buffer->data, size))
 		{
+			nyamodbus_stats_count(device, STAT_BUS_MESSAGES);
+			
 			if(driver->on_valid_packet)
 				driver->on_valid_packet(context, buffer->data, size);
 		}
 		else
 		{
+			nyamodbus_stats_count(device, STAT_BUS_ERRORS);
+			
 			if(driver->on_invalid_packet)
 				driver->on_invalid_packet(context);
 		}
@@ -227,7 +540,9 @@ void nyamodbus_tick(const str_nyamodbus_device * device, const str_nyamodbus_dri
 {
 	if (device->state->busy)
 	{
-		uint32_t timeout = (device->state->buffer.added > 0) ? NYAMODBUS_PACKET_WAIT_TIMEOUT : NYAMODBUS_PACKET_START_TIMEOUT;
+		uint32_t start_timeout = device->state->start_timeout_us ? device->state->start_timeout_us : NYAMODBUS_PACKET_START_TIMEOUT;
+		bool receiving = (device->state->buffer.added > 0) || device->state->skip;
+		uint32_t timeout = receiving ? NYAMODBUS_PACKET_WAIT_TIMEOUT : start_timeout;
 		device->state->elapsed_us += usecs;
 		
 		if(device->state->elapsed_us >= timeout)
@@ -237,6 +552,24 @@ void nyamodbus_tick(const str_nyamodbus_device * device, const str_nyamodbus_dri
 			device->state->busy = false;
 		}
 	}
+	
+	// Echo is lost
+	if(device->state->echo.size > 0)
+	{
+		str_nyamodbus_echo * echo = &device->state->echo;
+		// Not received bytes are still transmitted
+		uint32_t timeout = (echo->size - echo->matched) * device->io->char_us + NYAMODBUS_ECHO_TIMEOUT;
+		
+		echo->elapsed_us += usecs;
+		if(echo->elapsed_us >= timeout)
+		{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
+			printf(" Echo timeout (%d of %d bytes)\n", echo->matched, echo->size);
+#endif
+			echo->size    = 0;
+			echo->matched = 0;
+		}
+	}
 }
 
 // Start timer
@@ -256,3 +589,11 @@ void nyamodbus_reset_timeout(const str_nyamodbus_device * device)
 		device->state->elapsed_us = 0;
 	}
 }
+
+// Set time to wait start of answer for current transaction
+// device: device context
+//  usecs: timeout
+void nyamodbus_set_start_timeout(const str_nyamodbus_device * device, uint32_t usecs)
+{
+	device->state->start_timeout_us = usecs;
+}
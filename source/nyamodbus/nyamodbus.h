@@ -10,6 +10,18 @@
 
 #include "nyamodbus_config.h"
 
+// Max registers in one packet (limited by buffer sizes)
+#define NYAMODBUS_MAX_REGISTERS (((NYAMODBUS_BUFFER_SIZE > NYAMODBUS_OUTPUT_BUFFER_SIZE) ? NYAMODBUS_BUFFER_SIZE : NYAMODBUS_OUTPUT_BUFFER_SIZE) / 2)
+
+// Max registers in one read request (protocol limit, FC03/FC04/FC23)
+#define NYAMODBUS_MAX_READ_REGISTERS 125
+
+// Max coils or contacts in one read request (protocol limit, FC01/FC02)
+#define NYAMODBUS_MAX_READ_BITS      2000
+
+// Max coils in one write request (protocol limit, FC15)
+#define NYAMODBUS_MAX_WRITE_BITS     0x7B0
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -43,6 +55,12 @@ extern "C" {
 		
 		FUNCTION_REPORT_SLAVE_ID            = 17,
 		
+		FUNCTION_READ_FILE_RECORD           = 20,
+		FUNCTION_WRITE_FILE_RECORD          = 21,
+		FUNCTION_MASK_WRITE_HOLDING         = 22,
+		FUNCTION_READWRITE_HOLDING          = 23,
+		FUNCTION_READ_FIFO                  = 24,
+		
 		FUNCTION_READ_DEVICE_IDENTIFICATION = 43
 	} enum_modbus_function_code;
 
@@ -59,6 +77,11 @@ extern "C" {
 		ERROR_PARITY          = 8, // The slave detected a parity error when reading the extended memory. The master can repeat the request, but usually in such cases, repairs are required.
 		
 		ERROR_TIMEOUT         = 100, // Timeout error
+		ERROR_CRC             = 101, // Response with invalid crc
+		ERROR_OFFLINE         = 102, // Slave is offline, request is not sent
+		ERROR_OVERFLOW        = 103, // Request queue is full, request is not sent
+		ERROR_INV_RESPONSE    = 104, // Response does not match request
+		ERROR_PENDING         = 105, // Slave handler: request is accepted, response will be sent after nyamodbus_slave_complete()
 	} enum_nyamodbus_error;
 
 	// Is device still sending data
@@ -100,11 +123,75 @@ extern "C" {
 	// return: error code
 	typedef enum_nyamodbus_error (*nyamb_writeholding)(uint16_t id, uint16_t value);
 
+	// Mask write holding register: value = (value & and_mask) | (or_mask & ~and_mask)
+	//       id: index of register
+	// and_mask: and mask
+	//  or_mask: or mask
+	// return: error code
+	typedef enum_nyamodbus_error (*nyamb_maskwriteholding)(uint16_t id, uint16_t and_mask, uint16_t or_mask);
+
+	// Read block of digital values (coils, contacts)
+	//  start: index of first value
+	//  count: value count
+	//   bits: packed values [(count + 7) / 8], value 0 is bit 0 of byte 0
+	// return: error code
+	typedef enum_nyamodbus_error (*nyamb_readdigital_range)(uint16_t start, uint16_t count, uint8_t * bits);
+
+	// Read block of analog values (inputs, holding registers)
+	//  start: index of first register
+	//  count: register count
+	// values: registers [count]
+	// return: error code
+	typedef enum_nyamodbus_error (*nyamb_readanalog_range)(uint16_t start, uint16_t count, uint16_t * values);
+
+	// Write block of coils
+	//  start: index of first coil
+	//  count: coil count
+	//   bits: packed values [(count + 7) / 8], value 0 is bit 0 of byte 0
+	// return: error code
+	typedef enum_nyamodbus_error (*nyamb_writecoil_range)(uint16_t start, uint16_t count, const uint8_t * bits);
+
+	// Write block of holding registers
+	//  start: index of first register
+	//  count: register count
+	// values: registers [count]
+	// return: error code
+	typedef enum_nyamodbus_error (*nyamb_writeholding_range)(uint16_t start, uint16_t count, const uint16_t * values);
+
+	// Validate block of coils before write
+	//  start: index of first coil
+	//  count: coil count
+	//   bits: packed new values [(count + 7) / 8], value 0 is bit 0 of byte 0
+	// return: error code (ERROR_OK - write is allowed)
+	typedef enum_nyamodbus_error (*nyamb_validatecoils)(uint16_t start, uint16_t count, const uint8_t * bits);
+
+	// Validate block of holding registers before write
+	//  start: index of first register
+	//  count: register count
+	// values: new values [count]
+	// return: error code (ERROR_OK - write is allowed)
+	typedef enum_nyamodbus_error (*nyamb_validateholding)(uint16_t start, uint16_t count, const uint16_t * values);
+
+	// Block of values was changed
+	// start: index of first value
+	// count: value count
+	typedef void (*nyamb_changed)(uint16_t start, uint16_t count);
+
 	// Read device information
 	//  object: object id
 	//  return: pointer to id string or 0
 	typedef const char * (*nyamb_readdeviceinfo)(uint8_t object);
 
+	// Read exception status (FC07)
+	// return: 8 status bits
+	typedef uint8_t (*nyamb_readexceptionstatus)(void);
+
+	// Report slave id (FC17)
+	//   data: buffer for slave id, run indicator status (0x00 - off, 0xFF - on) and additional data
+	//   size: buffer size
+	// return: bytes in buffer
+	typedef uint8_t (*nyamb_reportslaveid)(uint8_t * data, uint8_t size);
+
 	// Prototype of function to parse modbus packet
 	// context: device context
 	//    data: data
@@ -115,6 +202,59 @@ extern "C" {
 	// context: device context
 	typedef void (*nyamb_driver_event)(void * context);
 	
+	// Prototype of function to check packet address
+	// context: device context
+	// address: first byte of packet
+	//  return: true, if packet must be received, else it is skipped until silence
+	typedef bool (*nyamb_accept_address)(void * context, uint8_t address);
+	
+	// Diagnostic counters (FC08 subfunctions 0x0B..0x12 in same order)
+	typedef enum {
+		STAT_BUS_MESSAGES   = 0, // Messages on bus (valid crc or skipped)
+		STAT_BUS_ERRORS     = 1, // Messages with invalid crc
+		STAT_EXCEPTIONS     = 2, // Exception responses sent by slave
+		STAT_SLAVE_MESSAGES = 3, // Messages addressed to slave or broadcast
+		STAT_NO_RESPONSES   = 4, // Messages addressed to slave without response (broadcast)
+		STAT_NAKS           = 5, // Negative acknowledge responses sent by slave
+		STAT_BUSY           = 6, // Slave busy responses sent by slave
+		STAT_OVERRUNS       = 7, // Messages longer than receive buffer
+		
+		STAT_COUNT
+	} enum_nyamodbus_stat;
+	
+	// Statistics block: counters are changed by modbus thread only without locks, can be readed by any thread
+	typedef struct {
+		uint16_t counters[STAT_COUNT];
+	} str_nyamodbus_stats;
+	
+	// Interrupt receive ring: bytes and frame ends are added by interrupt (one producer),
+	// processed by nyamodbus_main (one consumer) without locks
+	typedef struct {
+		// Received bytes
+		uint8_t  data[NYAMODBUS_RX_RING_SIZE];
+		// Byte counters: write (interrupt), read (main)
+		uint16_t head;
+		uint16_t tail;
+		
+		// Byte counters at frame ends
+		uint16_t ends[NYAMODBUS_RX_FRAME_COUNT];
+		// Frame end counters: write (interrupt), read (main)
+		uint16_t end_head;
+		uint16_t end_tail;
+	} str_nyamodbus_rx;
+	
+	// Expected echo of sent frame
+	typedef struct {
+		// Sent frame
+		uint8_t  data[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+		// Frame size (0 - no echo is expected)
+		uint8_t  size;
+		// Received echo bytes
+		uint8_t  matched;
+		// Usecs after send or last echo byte
+		uint32_t elapsed_us;
+	} str_nyamodbus_echo;
+	
 	// Buffer
 	typedef struct {
 		// Data buffer
@@ -134,6 +274,12 @@ extern "C" {
 		
 		// Is sending
 		nyamb_getstatus      is_txbusy;
+		
+		// Sent bytes are received back (half-duplex RS-485 adapter), they are skipped
+		bool                 echo;
+		
+		// Time of one character on line, usecs (echo is waited for transmission time of frame + NYAMODBUS_ECHO_TIMEOUT)
+		uint32_t             char_us;
 	} str_modbus_io;
 	
 	// Driver state
@@ -149,6 +295,9 @@ extern "C" {
 		
 		// Any data are received
 		nyamb_driver_event      on_data;
+		
+		// Check address of packet (optional)
+		nyamb_accept_address    accept_address;
     } str_nyamodbus_driver;
     
 	// Driver state
@@ -168,11 +317,23 @@ extern "C" {
 		// Time after last data
 		uint32_t                  elapsed_us;
 		
+		// Usecs to wait start to answer (0 - NYAMODBUS_PACKET_START_TIMEOUT)
+		uint32_t                  start_timeout_us;
+		
 		// Is master busy
 		bool                      busy;
 		
+		// Packet is addressed to other device, bytes are skipped until silence
+		bool                      skip;
+		
+		// Packet is longer than rx buffer
+		bool                      overrun;
+		
 		// rx buffer
 		str_nyamodbus_buffer      buffer;
+		
+		// Expected echo (is not cleared by reset)
+		str_nyamodbus_echo        echo;
 	} str_nyamodbus_state;
 	
 	// Modbus driver config and state
@@ -181,6 +342,10 @@ extern "C" {
 		const str_modbus_io        * io;
 		// Modbus buffers for packet receiving
 		str_nyamodbus_state        * state;
+		// Diagnostic counters (optional)
+		str_nyamodbus_stats        * stats;
+		// Interrupt receive ring (optional, used with nyamodbus_rx_byte/nyamodbus_rx_frame)
+		str_nyamodbus_rx           * rx;
 	}
 	str_nyamodbus_device;
 
@@ -200,6 +365,19 @@ extern "C" {
 	//   size: data size
 	void nyamodbus_send_packet(const str_nyamodbus_device * device, const uint8_t * data, uint8_t size);
 
+	// Make frame: data with crc
+	//  frame: result [size + 2]
+	//   data: data without crc
+	//   size: data size
+	// return: frame size
+	uint8_t nyamodbus_make_frame(uint8_t * frame, const uint8_t * data, uint8_t size);
+
+	// Send prepared frame
+	// device: device context
+	//  frame: data with crc
+	//   size: frame size
+	void nyamodbus_send_frame(const str_nyamodbus_device * device, const uint8_t * frame, uint8_t size);
+
 	// Trigger modbus timeout (parse received data)
 	//  device: device context
 	//  driver: functions to process packets
@@ -209,6 +387,21 @@ extern "C" {
 	// Reset modbus state
 	void nyamodbus_reset(const str_nyamodbus_device * device);
 
+	// Increment diagnostic counter (modbus thread)
+	// device: device context
+	//   stat: counter
+	void nyamodbus_stats_count(const str_nyamodbus_device * device, enum_nyamodbus_stat stat);
+
+	// Get diagnostic counter (any thread)
+	// device: device context
+	//   stat: counter
+	// return: counter value (0 if statistics block is not set)
+	uint16_t nyamodbus_stats_get(const str_nyamodbus_device * device, enum_nyamodbus_stat stat);
+
+	// Clear diagnostic counters (modbus thread)
+	// device: device context
+	void nyamodbus_stats_clear(const str_nyamodbus_device * device);
+
 	// Start timer
 	// device: device context
 	void nyamodbus_start_timeout(const str_nyamodbus_device * device);
@@ -217,10 +410,41 @@ extern "C" {
 	// device: device context
 	void nyamodbus_reset_timeout(const str_nyamodbus_device * device);
 
+	// Set time to wait start of answer for current transaction
+	// device: device context
+	//  usecs: timeout
+	void nyamodbus_set_start_timeout(const str_nyamodbus_device * device, uint32_t usecs);
+
 	// Is busy
 	// device: device context
 	bool nyamodbus_is_busy(const str_nyamodbus_device * device);
 
+	// Is device still sending data
+	// device: device context
+	bool nyamodbus_is_txbusy(const str_nyamodbus_device * device);
+
+	// Is address broadcast (0 by specification, 255 is accepted too)
+	// address: slave address
+	bool nyamodbus_is_broadcast(uint8_t address);
+
+	// Add received byte (interrupt safe, one producer)
+	// device: device context
+	//   byte: received byte
+	// return: false, if ring is full or device has no rx ring (byte is lost)
+	bool nyamodbus_rx_byte(const str_nyamodbus_device * device, uint8_t byte);
+
+	// Mark end of frame (interrupt safe, one producer): frame is parsed without silence timeout (idle line)
+	// device: device context
+	// return: false, if there are too many frame ends or device has no rx ring
+	bool nyamodbus_rx_frame_end(const str_nyamodbus_device * device);
+
+	// Add received frame (interrupt safe, one producer): bytes and end of frame (DMA)
+	// device: device context
+	//   data: frame data
+	//   size: frame size
+	// return: false, if there is no space or device has no rx ring (frame is lost)
+	bool nyamodbus_rx_frame(const str_nyamodbus_device * device, const uint8_t * data, uint16_t size);
+
 	// Tick modbus timer
 	//  device: device context
 	//  driver: functions to process packets
@@ -0,0 +1,184 @@
+//
+// Nyamodbus library bitsets v1.1.0
+//
+
+#include "nyamodbus_bits.h"
+#include <string.h>
+
+// Host byte order: packed bits are little endian
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	#define BITS_WORD(x) __builtin_bswap64(x)
+#else
+	#define BITS_WORD(x) (x)
+#endif
+
+// Mask of lower bits
+// count: bit count (1..64)
+static uint64_t nyamodbus_bits_mask(uint8_t count)
+{
+	return (count < 64) ? ((((uint64_t)1) << count) - 1) : ~((uint64_t)0);
+}
+
+// Load up to 64 bits
+//   bits: packed bits
+// offset: index of first bit
+//  count: bit count (1..64)
+// return: bits, first bit is bit 0
+static uint64_t nyamodbus_bits_load(const uint8_t * bits, uint32_t offset, uint8_t count)
+{
+	const uint8_t * data = &bits[offset / 8];
+	uint8_t  shift = offset & 0x07;
+	uint8_t  bytes = (shift + count + 7) / 8;
+	uint64_t value = 0;
+	
+	if(bytes >= 8)
+	{
+		memcpy(&value, data, 8);
+		value = BITS_WORD(value) >> shift;
+		
+		if(bytes > 8)
+			value |= ((uint64_t)data[8]) << (64 - shift);
+	}
+	else
+	{
+		uint8_t i;
+		for(i = 0; i < bytes; i++)
+			value |= ((uint64_t)data[i]) << (i * 8);
+		
+		value >>= shift;
+	}
+	
+	return value & nyamodbus_bits_mask(count);
+}
+
+// Store up to 64 bits (other bits are kept)
+//   bits: packed bits
+// offset: index of first bit
+//  count: bit count (1..64)
+//  value: bits, first bit is bit 0
+static void nyamodbus_bits_store(uint8_t * bits, uint32_t offset, uint8_t count, uint64_t value)
+{
+	uint8_t * data = &bits[offset / 8];
+	uint8_t  shift = offset & 0x07;
+	uint8_t  bytes = (shift + count + 7) / 8;
+	uint64_t mask  = nyamodbus_bits_mask(count);
+	
+	value &= mask;
+	if(bytes >= 8)
+	{
+		uint64_t word;
+		
+		memcpy(&word, data, 8);
+		word = BITS_WORD(word);
+		word = (word & ~(mask << shift)) | (value << shift);
+		word = BITS_WORD(word);
+		memcpy(data, &word, 8);
+		
+		if(bytes > 8)
+		{
+			uint8_t high = (uint8_t)(mask >> (64 - shift));
+			data[8] = (data[8] & ~high) | (uint8_t)(value >> (64 - shift));
+		}
+	}
+	else
+	{
+		uint8_t i;
+		
+		// shift + count <= 56, all bits fit into word
+		mask  <<= shift;
+		value <<= shift;
+		for(i = 0; i < bytes; i++)
+		{
+			uint8_t m = (uint8_t)(mask >> (i * 8));
+			data[i] = (data[i] & ~m) | ((uint8_t)(value >> (i * 8)) & m);
+		}
+	}
+}
+
+// Get bit value
+//   bits: packed bits
+//  index: bit index
+// return: bit value
+bool nyamodbus_bits_get(const uint8_t * bits, uint32_t index)
+{
+	return (bits[index / 8] & (1 << (index & 0x07))) != 0;
+}
+
+// Set bit value
+//  bits: packed bits
+// index: bit index
+// value: bit value
+void nyamodbus_bits_set(uint8_t * bits, uint32_t index, bool value)
+{
+	if(value)
+		bits[index / 8] |= (1 << (index & 0x07));
+	else
+		bits[index / 8] &= ~(1 << (index & 0x07));
+}
+
+// Copy bits (64 bits per step, offsets may be unaligned, other bits of dst are kept)
+//        dst: destination packed bits
+// dst_offset: index of first destination bit
+//        src: source packed bits
+// src_offset: index of first source bit
+//      count: bit count
+void nyamodbus_bits_copy(uint8_t * dst, uint32_t dst_offset, const uint8_t * src, uint32_t src_offset, uint32_t count)
+{
+	// Both offsets are byte aligned: copy whole bytes
+	if(((dst_offset | src_offset) & 0x07) == 0)
+	{
+		memcpy(&dst[dst_offset / 8], &src[src_offset / 8], count / 8);
+		
+		dst_offset += count & ~0x07;
+		src_offset += count & ~0x07;
+		count &= 0x07;
+	}
+	
+	while(count > 0)
+	{
+		uint8_t part = (count > 64) ? 64 : count;
+		
+		nyamodbus_bits_store(dst, dst_offset, part, nyamodbus_bits_load(src, src_offset, part));
+		
+		dst_offset += part;
+		src_offset += part;
+		count      -= part;
+	}
+}
+
+// Read bits from bank
+//   bank: bit bank
+//  start: index of first bit
+//  count: bit count
+//   bits: packed bits [(count + 7) / 8], value 0 is bit 0 of byte 0
+// return: error code
+enum_nyamodbus_error nyamodbus_bitbank_read(const str_nyamodbus_bitbank * bank, uint16_t start, uint16_t count, uint8_t * bits)
+{
+	if((start < bank->start) || ((uint32_t)start + count > (uint32_t)bank->start + bank->count))
+		return ERROR_NO_DATAADDRESS;
+	
+	if(bank->on_read)
+		bank->on_read(start, count);
+	
+	nyamodbus_bits_copy(bits, 0, bank->bits, start - bank->start, count);
+	return ERROR_OK;
+}
+
+// Write bits to bank
+//   bank: bit bank
+//  start: index of first bit
+//  count: bit count
+//   bits: packed bits [(count + 7) / 8], value 0 is bit 0 of byte 0
+// return: error code
+enum_nyamodbus_error nyamodbus_bitbank_write(const str_nyamodbus_bitbank * bank, uint16_t start, uint16_t count, const uint8_t * bits)
+{
+	if((start < bank->start) || ((uint32_t)start + count > (uint32_t)bank->start + bank->count))
+		return ERROR_NO_DATAADDRESS;
+	
+	nyamodbus_bits_copy(bank->bits, start - bank->start, bits, 0, count);
+	
+	if(bank->on_write)
+		bank->on_write(start, count);
+	
+	return ERROR_OK;
+}
@@ -0,0 +1,82 @@
+//
+// Nyamodbus library bitsets v1.1.0
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _NYAMODBUS_BITS_H
+#define _NYAMODBUS_BITS_H
+
+#include "nyamodbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Bits are packed as in packet: bit n is (bits[n / 8] >> (n % 8)) & 1
+
+	// Bank access hook
+	//  start: index of first accessed bit
+	//  count: accessed bit count
+	typedef void (*nyamb_bitbank_hook)(uint16_t start, uint16_t count);
+
+	// Packed bit bank (coils, contacts)
+	typedef struct {
+		// Index of first bit
+		uint16_t            start;
+		
+		// Bit count
+		uint16_t            count;
+		
+		// Packed bits [(count + 7) / 8]
+		uint8_t *           bits;
+		
+		// Called before bits are readed (optional, can update bits)
+		nyamb_bitbank_hook  on_read;
+		
+		// Called after bits are written (optional)
+		nyamb_bitbank_hook  on_write;
+	} str_nyamodbus_bitbank;
+
+	// Get bit value
+	//   bits: packed bits
+	//  index: bit index
+	// return: bit value
+	bool nyamodbus_bits_get(const uint8_t * bits, uint32_t index);
+
+	// Set bit value
+	//  bits: packed bits
+	// index: bit index
+	// value: bit value
+	void nyamodbus_bits_set(uint8_t * bits, uint32_t index, bool value);
+
+	// Copy bits (64 bits per step, offsets may be unaligned, other bits of dst are kept)
+	//        dst: destination packed bits
+	// dst_offset: index of first destination bit
+	//        src: source packed bits
+	// src_offset: index of first source bit
+	//      count: bit count
+	void nyamodbus_bits_copy(uint8_t * dst, uint32_t dst_offset, const uint8_t * src, uint32_t src_offset, uint32_t count);
+
+	// Read bits from bank
+	//   bank: bit bank
+	//  start: index of first bit
+	//  count: bit count
+	//   bits: packed bits [(count + 7) / 8], value 0 is bit 0 of byte 0
+	// return: error code
+	enum_nyamodbus_error nyamodbus_bitbank_read(const str_nyamodbus_bitbank * bank, uint16_t start, uint16_t count, uint8_t * bits);
+
+	// Write bits to bank
+	//   bank: bit bank
+	//  start: index of first bit
+	//  count: bit count
+	//   bits: packed bits [(count + 7) / 8], value 0 is bit 0 of byte 0
+	// return: error code
+	enum_nyamodbus_error nyamodbus_bitbank_write(const str_nyamodbus_bitbank * bank, uint16_t start, uint16_t count, const uint8_t * bits);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
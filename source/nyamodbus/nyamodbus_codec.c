@@ -0,0 +1,338 @@
+//
+// Nyamodbus library codec v1.1.0
+//
+
+#include "nyamodbus_codec.h"
+#include <string.h>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define CODEC_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+	#include <emmintrin.h>
+	#define CODEC_KERNEL_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define CODEC_KERNEL_NEON
+#endif
+
+// Host byte order: packet data are big endian
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	#define CODEC_HOST_BIG_ENDIAN 1
+#else
+	#define CODEC_HOST_BIG_ENDIAN 0
+#endif
+
+// Is bytes in register must be swapped to convert wire <-> host
+// order: register order
+static bool codec_swap_bytes(enum_nyamodbus_word_order order)
+{
+	bool byteswap = (order & WORD_ORDER_BADC) != 0;
+
+	return CODEC_HOST_BIG_ENDIAN ? byteswap : !byteswap;
+}
+
+// Is registers in value must be reversed to convert wire <-> host
+// order: register order
+static bool codec_swap_words(enum_nyamodbus_word_order order)
+{
+	bool wordswap = (order & WORD_ORDER_CDAB) != 0;
+
+	return CODEC_HOST_BIG_ENDIAN ? wordswap : !wordswap;
+}
+
+// Permute bytes of values (scalar version)
+//        dst: destination
+//        src: source
+//      count: value count
+//      words: registers per value (1, 2, 4)
+// swap_bytes: swap bytes in each register
+// swap_words: reverse registers in each value
+static void codec_permute_scalar(uint8_t * dst, const uint8_t * src, uint32_t count, uint8_t words, bool swap_bytes, bool swap_words)
+{
+	uint8_t  hi = swap_bytes ? 1 : 0;
+	uint8_t  lo = swap_bytes ? 0 : 1;
+	uint32_t i;
+
+	for(i = 0; i < count; i++)
+	{
+		uint8_t w;
+		for(w = 0; w < words; w++)
+		{
+			uint8_t from = swap_words ? (words - 1 - w) : w;
+
+			dst[w * 2]     = src[from * 2 + hi];
+			dst[w * 2 + 1] = src[from * 2 + lo];
+		}
+
+		dst += words * 2;
+		src += words * 2;
+	}
+}
+
+#if defined(CODEC_KERNEL_AVX2)
+// Permute 32 byte blocks, return number of processed values
+static uint32_t codec_permute_simd(uint8_t * dst, const uint8_t * src, uint32_t count, uint8_t words, bool swap_bytes, bool swap_words)
+{
+	uint32_t per_block = 16 / words;
+	uint32_t blocks = count / per_block;
+	uint32_t i;
+
+	for(i = 0; i < blocks; i++)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i * 32));
+
+		if(swap_bytes)
+			v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+
+		if(swap_words && (words == 2))
+		{
+			v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+			v = _mm256_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		else if(swap_words && (words == 4))
+		{
+			v = _mm256_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+			v = _mm256_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		}
+
+		_mm256_storeu_si256((__m256i *)(dst + i * 32), v);
+	}
+
+	return blocks * per_block;
+}
+
+#elif defined(CODEC_KERNEL_SSE2)
+// Permute 16 byte blocks, return number of processed values
+static uint32_t codec_permute_simd(uint8_t * dst, const uint8_t * src, uint32_t count, uint8_t words, bool swap_bytes, bool swap_words)
+{
+	uint32_t per_block = 8 / words;
+	uint32_t blocks = count / per_block;
+	uint32_t i;
+
+	for(i = 0; i < blocks; i++)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i * 16));
+
+		if(swap_bytes)
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+
+		if(swap_words && (words == 2))
+		{
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		}
+		else if(swap_words && (words == 4))
+		{
+			v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+			v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+		}
+
+		_mm_storeu_si128((__m128i *)(dst + i * 16), v);
+	}
+
+	return blocks * per_block;
+}
+
+#elif defined(CODEC_KERNEL_NEON)
+// Permute 16 byte blocks, return number of processed values
+static uint32_t codec_permute_simd(uint8_t * dst, const uint8_t * src, uint32_t count, uint8_t words, bool swap_bytes, bool swap_words)
+{
+	uint32_t per_block = 8 / words;
+	uint32_t blocks = count / per_block;
+	uint32_t i;
+
+	for(i = 0; i < blocks; i++)
+	{
+		uint8x16_t v = vld1q_u8(src + i * 16);
+
+		if(swap_bytes)
+			v = vrev16q_u8(v);
+
+		if(swap_words && (words == 2))
+			v = vreinterpretq_u8_u16(vrev32q_u16(vreinterpretq_u16_u8(v)));
+		else if(swap_words && (words == 4))
+			v = vreinterpretq_u8_u16(vrev64q_u16(vreinterpretq_u16_u8(v)));
+
+		vst1q_u8(dst + i * 16, v);
+	}
+
+	return blocks * per_block;
+}
+
+#else
+// No vector unit: all values are processed by scalar code
+static uint32_t codec_permute_simd(uint8_t * dst, const uint8_t * src, uint32_t count, uint8_t words, bool swap_bytes, bool swap_words)
+{
+	return 0;
+}
+#endif
+
+// Convert values between wire and host representation
+//   dst: destination
+//   src: source
+// count: value count
+// words: registers per value (1, 2, 4)
+// order: register order
+static void codec_convert(void * dst, const void * src, uint32_t count, uint8_t words, enum_nyamodbus_word_order order)
+{
+	bool swap_bytes = codec_swap_bytes(order);
+	bool swap_words = (words > 1) && codec_swap_words(order);
+
+	if(!swap_bytes && !swap_words)
+	{
+		memcpy(dst, src, count * words * 2);
+	}
+	else
+	{
+		uint32_t done = codec_permute_simd((uint8_t *)dst, (const uint8_t *)src, count, words, swap_bytes, swap_words);
+		uint32_t offset = done * words * 2;
+
+		codec_permute_scalar((uint8_t *)dst + offset, (const uint8_t *)src + offset, count - done, words, swap_bytes, swap_words);
+	}
+}
+
+// Name of used codec kernel (scalar, sse2, avx2, neon)
+// return: kernel name
+const char * nyamodbus_codec_kernel(void)
+{
+#if defined(CODEC_KERNEL_AVX2)
+	return "avx2";
+#elif defined(CODEC_KERNEL_SSE2)
+	return "sse2";
+#elif defined(CODEC_KERNEL_NEON)
+	return "neon";
+#else
+	return "scalar";
+#endif
+}
+
+// Decode big endian registers from packet
+//   dst: registers [count]
+//   src: packet data [count * 2]
+// count: register count
+void nyamodbus_decode_u16(uint16_t * dst, const uint8_t * src, uint16_t count)
+{
+	codec_convert(dst, src, count, 1, WORD_ORDER_ABCD);
+}
+
+// Encode registers to big endian packet data
+//   dst: packet data [count * 2]
+//   src: registers [count]
+// count: register count
+void nyamodbus_encode_u16(uint8_t * dst, const uint16_t * src, uint16_t count)
+{
+	codec_convert(dst, src, count, 1, WORD_ORDER_ABCD);
+}
+
+// Decode 32 bit values from packet (2 registers per value)
+void nyamodbus_decode_u32(uint32_t * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 2, order);
+}
+
+void nyamodbus_decode_i32(int32_t * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 2, order);
+}
+
+void nyamodbus_decode_f32(float * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 2, order);
+}
+
+// Decode 64 bit values from packet (4 registers per value)
+void nyamodbus_decode_f64(double * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 4, order);
+}
+
+// Encode 32 bit values to packet data (2 registers per value)
+void nyamodbus_encode_u32(uint8_t * dst, const uint32_t * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 2, order);
+}
+
+void nyamodbus_encode_i32(uint8_t * dst, const int32_t * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 2, order);
+}
+
+void nyamodbus_encode_f32(uint8_t * dst, const float * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 2, order);
+}
+
+// Encode 64 bit values to packet data (4 registers per value)
+void nyamodbus_encode_f64(uint8_t * dst, const double * src, uint16_t count, enum_nyamodbus_word_order order)
+{
+	codec_convert(dst, src, count, 4, order);
+}
+
+// Convert register pair to 32 bit values
+uint32_t nyamodbus_regs_to_u32(const uint16_t * regs, enum_nyamodbus_word_order order)
+{
+	uint8_t  wire[4];
+	uint32_t value;
+
+	nyamodbus_encode_u16(wire, regs, 2);
+	nyamodbus_decode_u32(&value, wire, 1, order);
+	return value;
+}
+
+int32_t nyamodbus_regs_to_i32(const uint16_t * regs, enum_nyamodbus_word_order order)
+{
+	return (int32_t)nyamodbus_regs_to_u32(regs, order);
+}
+
+float nyamodbus_regs_to_f32(const uint16_t * regs, enum_nyamodbus_word_order order)
+{
+	uint8_t wire[4];
+	float   value;
+
+	nyamodbus_encode_u16(wire, regs, 2);
+	nyamodbus_decode_f32(&value, wire, 1, order);
+	return value;
+}
+
+// Convert 4 registers to 64 bit value
+double nyamodbus_regs_to_f64(const uint16_t * regs, enum_nyamodbus_word_order order)
+{
+	uint8_t wire[8];
+	double  value;
+
+	nyamodbus_encode_u16(wire, regs, 4);
+	nyamodbus_decode_f64(&value, wire, 1, order);
+	return value;
+}
+
+// Convert 32 bit values to register pair
+void nyamodbus_u32_to_regs(uint16_t * regs, uint32_t value, enum_nyamodbus_word_order order)
+{
+	uint8_t wire[4];
+
+	nyamodbus_encode_u32(wire, &value, 1, order);
+	nyamodbus_decode_u16(regs, wire, 2);
+}
+
+void nyamodbus_i32_to_regs(uint16_t * regs, int32_t value, enum_nyamodbus_word_order order)
+{
+	nyamodbus_u32_to_regs(regs, (uint32_t)value, order);
+}
+
+void nyamodbus_f32_to_regs(uint16_t * regs, float value, enum_nyamodbus_word_order order)
+{
+	uint8_t wire[4];
+
+	nyamodbus_encode_f32(wire, &value, 1, order);
+	nyamodbus_decode_u16(regs, wire, 2);
+}
+
+// Convert 64 bit value to 4 registers
+void nyamodbus_f64_to_regs(uint16_t * regs, double value, enum_nyamodbus_word_order order)
+{
+	uint8_t wire[8];
+
+	nyamodbus_encode_f64(wire, &value, 1, order);
+	nyamodbus_decode_u16(regs, wire, 4);
+}
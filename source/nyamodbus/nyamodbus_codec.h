@@ -0,0 +1,104 @@
+//
+// Nyamodbus library codec v1.1.0
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _NYAMODBUS_CODEC_H
+#define _NYAMODBUS_CODEC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Register order of multi-register values
+	// (A - most significant byte, wire order is shown)
+	typedef enum {
+		WORD_ORDER_ABCD = 0, // Big endian: high word first, high byte first
+		WORD_ORDER_BADC = 1, // Byte swap: high word first, low byte first
+		WORD_ORDER_CDAB = 2, // Word swap: low word first, high byte first
+		WORD_ORDER_DCBA = 3  // Little endian: low word first, low byte first
+	} enum_nyamodbus_word_order;
+
+	// Name of used codec kernel (scalar, sse2, avx2, neon)
+	// return: kernel name
+	const char * nyamodbus_codec_kernel(void);
+
+	// Decode big endian registers from packet
+	//   dst: registers [count]
+	//   src: packet data [count * 2]
+	// count: register count
+	void nyamodbus_decode_u16(uint16_t * dst, const uint8_t * src, uint16_t count);
+
+	// Encode registers to big endian packet data
+	//   dst: packet data [count * 2]
+	//   src: registers [count]
+	// count: register count
+	void nyamodbus_encode_u16(uint8_t * dst, const uint16_t * src, uint16_t count);
+
+	// Decode 32 bit values from packet (2 registers per value)
+	//   dst: values [count]
+	//   src: packet data [count * 4]
+	// count: value count
+	// order: register order
+	void nyamodbus_decode_u32(uint32_t * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order);
+	void nyamodbus_decode_i32(int32_t * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order);
+	void nyamodbus_decode_f32(float * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order);
+
+	// Decode 64 bit values from packet (4 registers per value)
+	//   dst: values [count]
+	//   src: packet data [count * 8]
+	// count: value count
+	// order: register order
+	void nyamodbus_decode_f64(double * dst, const uint8_t * src, uint16_t count, enum_nyamodbus_word_order order);
+
+	// Encode 32 bit values to packet data (2 registers per value)
+	//   dst: packet data [count * 4]
+	//   src: values [count]
+	// count: value count
+	// order: register order
+	void nyamodbus_encode_u32(uint8_t * dst, const uint32_t * src, uint16_t count, enum_nyamodbus_word_order order);
+	void nyamodbus_encode_i32(uint8_t * dst, const int32_t * src, uint16_t count, enum_nyamodbus_word_order order);
+	void nyamodbus_encode_f32(uint8_t * dst, const float * src, uint16_t count, enum_nyamodbus_word_order order);
+
+	// Encode 64 bit values to packet data (4 registers per value)
+	//   dst: packet data [count * 8]
+	//   src: values [count]
+	// count: value count
+	// order: register order
+	void nyamodbus_encode_f64(uint8_t * dst, const double * src, uint16_t count, enum_nyamodbus_word_order order);
+
+	// Convert register pair to 32 bit values
+	//   regs: registers [2] as readed by master
+	//  order: register order
+	// return: value
+	uint32_t nyamodbus_regs_to_u32(const uint16_t * regs, enum_nyamodbus_word_order order);
+	int32_t  nyamodbus_regs_to_i32(const uint16_t * regs, enum_nyamodbus_word_order order);
+	float    nyamodbus_regs_to_f32(const uint16_t * regs, enum_nyamodbus_word_order order);
+
+	// Convert 4 registers to 64 bit value
+	//   regs: registers [4] as readed by master
+	//  order: register order
+	// return: value
+	double   nyamodbus_regs_to_f64(const uint16_t * regs, enum_nyamodbus_word_order order);
+
+	// Convert 32 bit values to register pair
+	//   regs: registers [2] to write
+	//  value: value
+	//  order: register order
+	void nyamodbus_u32_to_regs(uint16_t * regs, uint32_t value, enum_nyamodbus_word_order order);
+	void nyamodbus_i32_to_regs(uint16_t * regs, int32_t value, enum_nyamodbus_word_order order);
+	void nyamodbus_f32_to_regs(uint16_t * regs, float value, enum_nyamodbus_word_order order);
+
+	// Convert 64 bit value to 4 registers
+	//   regs: registers [4] to write
+	//  value: value
+	//  order: register order
+	void nyamodbus_f64_to_regs(uint16_t * regs, double value, enum_nyamodbus_word_order order);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -22,5 +22,55 @@
 
 	// Usecs to wait start to answer
 	#define NYAMODBUS_PACKET_START_TIMEOUT 30000
+
+	// Usecs to wait after broadcast request before next request
+	#define NYAMODBUS_BROADCAST_TURNAROUND 100000
+
+	// Size of master request queue
+	#define NYAMODBUS_MASTER_QUEUE_SIZE    4
+
+	// Min usecs to wait start to answer for slaves with measured response time
+	#define NYAMODBUS_MASTER_MIN_START_TIMEOUT 3000
+
+	// Max usecs to wait start to answer for slaves with measured response time
+	#define NYAMODBUS_MASTER_MAX_START_TIMEOUT 200000
+
+	// Failed requests in a row to mark slave as offline
+	#define NYAMODBUS_MASTER_FAIL_LIMIT    3
+
+	// Usecs between probe requests to offline slave
+	#define NYAMODBUS_MASTER_PROBE_PERIOD  1000000
+
+	// Repeats of request if slave answers ERROR_BUSY (default retry policy)
+	#define NYAMODBUS_MASTER_BUSY_RETRIES  3
+
+	// Usecs to wait before repeating request to busy slave (default retry policy)
+	#define NYAMODBUS_MASTER_BUSY_BACKOFF  50000
+
+	// Max usecs to wait before repeating request
+	#define NYAMODBUS_MASTER_MAX_BACKOFF   1000000
+	
+	// Slave answers deferred request with ERROR_LONG_ACTION (acknowledge),
+	// result is sent when master repeats request after completion
+	// (0 - response is sent on completion, only if completion is always faster than master timeout)
+	#define NYAMODBUS_SLAVE_PENDING_ACK    1
+	
+	// Usecs to keep result of acknowledged deferred request until master repeats it (other requests are processed meanwhile)
+	#define NYAMODBUS_SLAVE_DONE_TIMEOUT   10000000
+	
+	// Size of encoded device identification objects (FC43)
+	#define NYAMODBUS_IDENTITY_CACHE_SIZE  256
+	
+	// Count of cached slave responses for REGMAP_CACHED ranges
+	#define NYAMODBUS_RESPONSE_CACHE_SIZE  4
+	
+	// Size of interrupt receive ring (power of 2)
+	#define NYAMODBUS_RX_RING_SIZE         256
+	
+	// Max frame ends in interrupt receive ring (power of 2)
+	#define NYAMODBUS_RX_FRAME_COUNT       8
+	
+	// Usecs to wait echo of sent bytes (io->echo) after transmission time of frame (io->char_us): adapter latency
+	#define NYAMODBUS_ECHO_TIMEOUT         2000
 	
 #endif
@@ -0,0 +1,106 @@
+//
+// Nyamodbus library FIFO queue v1.1.0
+//
+
+#include "nyamodbus_fifo.h"
+
+// Counters are shared by producer and consumer
+#if defined(__GNUC__)
+	#define FIFO_LOAD(ptr)           __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+	#define FIFO_LOAD_OWN(ptr)       __atomic_load_n(ptr, __ATOMIC_RELAXED)
+	#define FIFO_STORE(ptr, value)   __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#else
+	// Single core: volatile access is enough
+	#define FIFO_LOAD(ptr)           (*(volatile const uint16_t *)(ptr))
+	#define FIFO_LOAD_OWN(ptr)       (*(volatile const uint16_t *)(ptr))
+	#define FIFO_STORE(ptr, value)   (*(volatile uint16_t *)(ptr) = (value))
+#endif
+
+// Get count of queued values
+//   fifo: queue
+// return: value count
+uint16_t nyamodbus_fifo_count(const str_nyamodbus_fifo * fifo)
+{
+	return (uint16_t)(FIFO_LOAD(&fifo->head) - FIFO_LOAD(&fifo->tail));
+}
+
+// Push value (producer)
+//   fifo: queue
+//  value: value
+// return: true, if value is queued (false - queue is full)
+bool nyamodbus_fifo_push(str_nyamodbus_fifo * fifo, uint16_t value)
+{
+	return nyamodbus_fifo_push_block(fifo, &value, 1) == 1;
+}
+
+// Push values (producer)
+//   fifo: queue
+// values: values [count]
+//  count: value count
+// return: count of queued values
+uint16_t nyamodbus_fifo_push_block(str_nyamodbus_fifo * fifo, const uint16_t * values, uint16_t count)
+{
+	uint16_t head = FIFO_LOAD_OWN(&fifo->head);
+	uint16_t tail = FIFO_LOAD(&fifo->tail);
+	uint16_t free = fifo->size - (uint16_t)(head - tail);
+	uint16_t i;
+	
+	if(count > free)
+		count = free;
+	
+	for(i = 0; i < count; i++)
+		fifo->data[(uint16_t)(head + i) & (fifo->size - 1)] = values[i];
+	
+	// Values are visible to consumer after counter
+	FIFO_STORE(&fifo->head, (uint16_t)(head + count));
+	return count;
+}
+
+// Copy values without removing (consumer)
+//   fifo: queue
+// values: values [count]
+//  count: max value count
+// return: count of values
+uint16_t nyamodbus_fifo_peek(const str_nyamodbus_fifo * fifo, uint16_t * values, uint16_t count)
+{
+	uint16_t tail = FIFO_LOAD_OWN(&fifo->tail);
+	uint16_t head = FIFO_LOAD(&fifo->head);
+	uint16_t used = (uint16_t)(head - tail);
+	uint16_t i;
+	
+	if(count > used)
+		count = used;
+	
+	for(i = 0; i < count; i++)
+		values[i] = fifo->data[(uint16_t)(tail + i) & (fifo->size - 1)];
+	
+	return count;
+}
+
+// Remove values (consumer, e.g. after master confirmed received values)
+//   fifo: queue
+//  count: max value count
+// return: count of removed values
+uint16_t nyamodbus_fifo_drop(str_nyamodbus_fifo * fifo, uint16_t count)
+{
+	uint16_t tail = FIFO_LOAD_OWN(&fifo->tail);
+	uint16_t head = FIFO_LOAD(&fifo->head);
+	uint16_t used = (uint16_t)(head - tail);
+	
+	if(count > used)
+		count = used;
+	
+	// Space is free for producer after counter
+	FIFO_STORE(&fifo->tail, (uint16_t)(tail + count));
+	return count;
+}
+
+// Pop values (consumer)
+//   fifo: queue
+// values: values [count]
+//  count: max value count
+// return: count of values
+uint16_t nyamodbus_fifo_pop(str_nyamodbus_fifo * fifo, uint16_t * values, uint16_t count)
+{
+	return nyamodbus_fifo_drop(fifo, nyamodbus_fifo_peek(fifo, values, count));
+}
@@ -0,0 +1,75 @@
+//
+// Nyamodbus library FIFO queue v1.1.0
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _NYAMODBUS_FIFO_H
+#define _NYAMODBUS_FIFO_H
+
+// Max registers in FC24 response
+#define NYAMODBUS_FIFO_MAX_COUNT 31
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Lock-free register queue: one producer (thread or interrupt), one consumer (modbus thread: FC24 and nyamodbus_fifo_drop)
+	typedef struct {
+		// Queue buffer [size]
+		uint16_t * data;
+		
+		// Buffer size, must be power of 2
+		uint16_t   size;
+		
+		// Write counter (producer)
+		uint16_t   head;
+		
+		// Read counter (consumer)
+		uint16_t   tail;
+	} str_nyamodbus_fifo;
+
+	// Get count of queued values
+	//   fifo: queue
+	// return: value count
+	uint16_t nyamodbus_fifo_count(const str_nyamodbus_fifo * fifo);
+
+	// Push value (producer)
+	//   fifo: queue
+	//  value: value
+	// return: true, if value is queued (false - queue is full)
+	bool nyamodbus_fifo_push(str_nyamodbus_fifo * fifo, uint16_t value);
+
+	// Push values (producer)
+	//   fifo: queue
+	// values: values [count]
+	//  count: value count
+	// return: count of queued values
+	uint16_t nyamodbus_fifo_push_block(str_nyamodbus_fifo * fifo, const uint16_t * values, uint16_t count);
+
+	// Copy values without removing (consumer)
+	//   fifo: queue
+	// values: values [count]
+	//  count: max value count
+	// return: count of values
+	uint16_t nyamodbus_fifo_peek(const str_nyamodbus_fifo * fifo, uint16_t * values, uint16_t count);
+
+	// Remove values (consumer, e.g. after master confirmed received values)
+	//   fifo: queue
+	//  count: max value count
+	// return: count of removed values
+	uint16_t nyamodbus_fifo_drop(str_nyamodbus_fifo * fifo, uint16_t count);
+
+	// Pop values (consumer)
+	//   fifo: queue
+	// values: values [count]
+	//  count: max value count
+	// return: count of values
+	uint16_t nyamodbus_fifo_pop(str_nyamodbus_fifo * fifo, uint16_t * values, uint16_t count);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+//
+// Nyamodbus library file records v1.1.0
+//
+
+#include "nyamodbus_file.h"
+
+#if defined(__linux__)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+// Find file
+//  files: files [count]
+//  count: file count
+// number: file number
+// return: file or 0
+const str_nyamodbus_file * nyamodbus_file_find(const str_nyamodbus_file * files, uint16_t count, uint16_t number)
+{
+	uint16_t i;
+	
+	for(i = 0; i < count; i++)
+	{
+		if(files[i].number == number)
+			return &files[i];
+	}
+	
+	return 0;
+}
+
+// Check access to records
+//   file: file (can be 0)
+// record: first record
+//  count: record count
+//   flag: FILE_READ or FILE_WRITE
+// return: ERROR_OK or error code
+enum_nyamodbus_error nyamodbus_file_check(const str_nyamodbus_file * file, uint16_t record, uint16_t count, uint8_t flag)
+{
+	if(!file || !file->data || ((file->flags & flag) == 0))
+		return ERROR_NO_DATAADDRESS;
+	
+	if((count == 0) || ((uint32_t)record + count > file->records))
+		return ERROR_NO_DATAADDRESS;
+	
+	return ERROR_OK;
+}
+
+#if defined(__linux__)
+// Map file on disk as record file (records are shared with file)
+//     file: record file to fill (number, flags and on_write are not changed)
+//     path: path to file
+// writable: records can be written (required for FILE_WRITE flag)
+//   return: true, if file is mapped
+bool nyamodbus_file_map(str_nyamodbus_file * file, const char * path, bool writable)
+{
+	struct stat info;
+	size_t size;
+	void * data;
+	int fd = open(path, writable ? O_RDWR : O_RDONLY);
+	
+	if(fd < 0)
+		return false;
+	
+	if((fstat(fd, &info) != 0) || (info.st_size < 2))
+	{
+		close(fd);
+		return false;
+	}
+	
+	size = (size_t)info.st_size / 2;
+	if(size > NYAMODBUS_FILE_MAX_RECORDS)
+		size = NYAMODBUS_FILE_MAX_RECORDS;
+	
+	data = mmap(0, size * 2, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+	
+	// Mapping is kept after close
+	close(fd);
+	
+	if(data == MAP_FAILED)
+		return false;
+	
+	file->data    = (uint8_t *)data;
+	file->records = (uint16_t)size;
+	return true;
+}
+
+// Unmap file mapped by nyamodbus_file_map
+//   file: record file
+void nyamodbus_file_unmap(str_nyamodbus_file * file)
+{
+	if(file->data)
+		munmap(file->data, (size_t)file->records * 2);
+	
+	file->data    = 0;
+	file->records = 0;
+}
+#endif
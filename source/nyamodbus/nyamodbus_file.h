@@ -0,0 +1,90 @@
+//
+// Nyamodbus library file records v1.1.0
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _NYAMODBUS_FILE_H
+#define _NYAMODBUS_FILE_H
+
+#include "nyamodbus.h"
+
+// Records in one file (record numbers 0..9999)
+#define NYAMODBUS_FILE_MAX_RECORDS 10000
+
+// Reference type of file subrequest
+#define NYAMODBUS_FILE_REFERENCE   6
+
+// Max packet size with file records (address..data, without crc)
+#define NYAMODBUS_FILE_MAX_PACKET  (((NYAMODBUS_BUFFER_SIZE < NYAMODBUS_OUTPUT_BUFFER_SIZE) ? NYAMODBUS_BUFFER_SIZE : NYAMODBUS_OUTPUT_BUFFER_SIZE) - 2)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// File access flags
+	typedef enum {
+		FILE_READ      = 0x01, // Records can be readed
+		FILE_WRITE     = 0x02, // Records can be written
+		FILE_READWRITE = 0x03
+	} enum_nyamodbus_file_flags;
+
+	// File access hook
+	//   file: file number
+	// record: first accessed record
+	//  count: accessed record count
+	typedef void (*nyamb_file_hook)(uint16_t file, uint16_t record, uint16_t count);
+
+	// Record file
+	typedef struct {
+		// File number
+		uint16_t            number;
+		
+		// Record count (max NYAMODBUS_FILE_MAX_RECORDS)
+		uint16_t            records;
+		
+		// Records [records * 2] in packet byte order (big endian),
+		// plain array or mapped file (nyamodbus_file_map)
+		uint8_t *           data;
+		
+		// Access flags (enum_nyamodbus_file_flags)
+		uint8_t             flags;
+		
+		// Called after records are written (optional)
+		nyamb_file_hook     on_write;
+	} str_nyamodbus_file;
+
+	// Find file
+	//  files: files [count]
+	//  count: file count
+	// number: file number
+	// return: file or 0
+	const str_nyamodbus_file * nyamodbus_file_find(const str_nyamodbus_file * files, uint16_t count, uint16_t number);
+
+	// Check access to records
+	//   file: file (can be 0)
+	// record: first record
+	//  count: record count
+	//   flag: FILE_READ or FILE_WRITE
+	// return: ERROR_OK or error code
+	enum_nyamodbus_error nyamodbus_file_check(const str_nyamodbus_file * file, uint16_t record, uint16_t count, uint8_t flag);
+
+#if defined(__linux__)
+	// Map file on disk as record file (records are shared with file)
+	//     file: record file to fill (number, flags and on_write are not changed)
+	//     path: path to file
+	// writable: records can be written (required for FILE_WRITE flag)
+	//   return: true, if file is mapped
+	bool nyamodbus_file_map(str_nyamodbus_file * file, const char * path, bool writable);
+
+	// Unmap file mapped by nyamodbus_file_map
+	//   file: record file
+	void nyamodbus_file_unmap(str_nyamodbus_file * file);
+#endif
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
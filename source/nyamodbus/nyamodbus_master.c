@@ -4,17 +4,29 @@
 
 #include "nyamodbus_master.h"
 #include "nyamodbus_utils.h"
+#include "nyamodbus_codec.h"
+#include "nyamodbus_fifo.h"
+#include "nyamodbus_file.h"
 #include <string.h>
 #include <stdio.h>
 
 static void nyamodbus_master_on_valid_packet(void * context, const uint8_t * data, uint16_t size);
+static void nyamodbus_master_on_invalid_packet(void * context);
 static void nyamodbus_master_on_timeout(void * context);
 static void nyamodbus_master_on_data(void * context);
 
+// Retry policy if nothing is configured
+static const str_nyamodbus_retry_policy default_retry = {
+	.retries        = NYAMODBUS_MASTER_BUSY_RETRIES,
+	.backoff_us     = NYAMODBUS_MASTER_BUSY_BACKOFF,
+	.max_backoff_us = NYAMODBUS_MASTER_BUSY_BACKOFF,
+	.flags          = RETRY_ON_BUSY
+};
+
 const str_nyamodbus_driver master_driver = {
 	.on_data            = nyamodbus_master_on_data,
 	.on_valid_packet    = nyamodbus_master_on_valid_packet,
-	.on_invalid_packet  = nyamodbus_master_on_timeout,
+	.on_invalid_packet  = nyamodbus_master_on_invalid_packet,
 	.on_timeout         = nyamodbus_master_on_timeout,
 };
 
@@ -33,38 +45,187 @@ void nyamodbus_master_init(const str_nyamodbus_master_device * device)
 #endif
 
 	memset(device->state, 0, sizeof(str_nyamodbus_master_state));
+	
+	if(device->queue)
+		memset(device->queue, 0, sizeof(str_nyamodbus_master_queue));
+	
+	if(device->transfer)
+		memset(device->transfer, 0, sizeof(str_nyamodbus_master_transfer));
+	
+	if(device->slaves)
+	{
+		uint8_t i;
+		for(i = 0; i < device->slave_count; i++)
+		{
+			device->slaves[i].srtt_us    = 0;
+			device->slaves[i].rttvar_us  = 0;
+			device->slaves[i].failures   = 0;
+			device->slaves[i].offline    = false;
+			device->slaves[i].probe_us   = 0;
+			device->slaves[i].echo_us    = 0;
+			
+			// Initial timeout of slave is kept
+			if(device->slaves[i].timeout_us == 0)
+				device->slaves[i].timeout_us = NYAMODBUS_PACKET_START_TIMEOUT;
+		}
+	}
 
 	nyamodbus_init(device->device);
 }
 
+// Find slave link state
+// device: device context
+//  slave: address of slave device
+// return: slave state or 0
+static str_nyamodbus_master_slave * nyamodbus_master_find_slave(const str_nyamodbus_master_device * device, uint8_t slave)
+{
+	if(device->slaves)
+	{
+		uint8_t i;
+		for(i = 0; i < device->slave_count; i++)
+		{
+			if(device->slaves[i].address == slave)
+				return &device->slaves[i];
+		}
+	}
+	
+	return 0;
+}
+
+// Limit start timeout
+//  usecs: timeout
+// return: timeout in allowed range
+static uint32_t nyamodbus_master_limit_timeout(uint32_t usecs)
+{
+	if(usecs < NYAMODBUS_MASTER_MIN_START_TIMEOUT)
+		return NYAMODBUS_MASTER_MIN_START_TIMEOUT;
+	
+	if(usecs > NYAMODBUS_MASTER_MAX_START_TIMEOUT)
+		return NYAMODBUS_MASTER_MAX_START_TIMEOUT;
+	
+	return usecs;
+}
+
+// Update slave response time estimation (like TCP SRTT/RTTVAR)
+//  slave: slave link state
+//  usecs: measured response time
+static void nyamodbus_master_update_rtt(str_nyamodbus_master_slave * slave, uint32_t usecs)
+{
+	if(slave->srtt_us == 0)
+	{
+		slave->srtt_us   = usecs ? usecs : 1;
+		slave->rttvar_us = usecs / 2;
+	}
+	else
+	{
+		uint32_t delta = (slave->srtt_us > usecs) ? (slave->srtt_us - usecs) : (usecs - slave->srtt_us);
+		
+		slave->rttvar_us = (3 * slave->rttvar_us + delta) / 4;
+		slave->srtt_us   = (7 * slave->srtt_us + usecs) / 8;
+		if(slave->srtt_us == 0) slave->srtt_us = 1;
+	}
+	
+	slave->timeout_us = nyamodbus_master_limit_timeout(slave->srtt_us + 4 * slave->rttvar_us);
+	
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+	printf("Slave %d response %u us, srtt %u us, timeout %u us\n", slave->address, usecs, slave->srtt_us, slave->timeout_us);
+#endif
+}
+
+// Slave answered to request
+// device: device context
+//  slave: slave link state
+static void nyamodbus_master_slave_ok(const str_nyamodbus_master_device * device, str_nyamodbus_master_slave * slave)
+{
+	slave->failures = 0;
+	
+	if(slave->offline)
+	{
+		slave->offline = false;
+		
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+		printf("Slave %d is online\n", slave->address);
+#endif
+		if(device->on_slave_status)
+			device->on_slave_status(slave->address, true);
+	}
+}
+
+// Slave request failed (no answer or invalid answer)
+// device: device context
+//  slave: slave link state
+static void nyamodbus_master_slave_failed(const str_nyamodbus_master_device * device, str_nyamodbus_master_slave * slave)
+{
+	if(slave->failures < 0xFF)
+		slave->failures++;
+	
+	if(!slave->offline && (slave->failures >= NYAMODBUS_MASTER_FAIL_LIMIT))
+	{
+		slave->offline  = true;
+		slave->probe_us = 0;
+		
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+		printf("Slave %d is offline\n", slave->address);
+#endif
+		if(device->on_slave_status)
+			device->on_slave_status(slave->address, false);
+	}
+}
+
+// Is slave online (answers to requests)
+// device: device context
+//  slave: address of slave device
+// return: false if slave is marked offline
+bool nyamodbus_master_is_online(const str_nyamodbus_master_device * device, uint8_t slave)
+{
+	str_nyamodbus_master_slave * link = nyamodbus_master_find_slave(device, slave);
+	
+	return !link || !link->offline;
+}
+
+// Get usecs to wait start of answer from slave
+// device: device context
+//  slave: address of slave device
+// return: timeout
+uint32_t nyamodbus_master_get_timeout(const str_nyamodbus_master_device * device, uint8_t slave)
+{
+	str_nyamodbus_master_slave * link = nyamodbus_master_find_slave(device, slave);
+	
+	return (link && link->timeout_us) ? link->timeout_us : NYAMODBUS_PACKET_START_TIMEOUT;
+}
+
 // Parse "read contacts" response
 //        device: device context
 //  request_data: request data
 //  request_size: request data size
 // response_data: response data
-// response_size: response data size
-static void nyamodbus_master_parse_read_contacts(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_read_contacts(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
 {
 	// Check request info...
 	uint16_t address = get_u16_value(request_data, 2);
 	uint16_t count   = get_u16_value(request_data, 4);
 	uint8_t  bytes = (count + 7) / 8;
 	uint8_t  slave = response_data[0];
+	str_nyamodbus_master_slave * link;
+	
+	// Expected payload size
+	if((request_size < 6) || (bytes != response_data[2]) || (response_size != 5 + bytes))
+		return false;
+	
+	link = nyamodbus_master_find_slave(device, slave);
+	if(link && link->contacts)
+		nyamodbus_bitbank_write(link->contacts, address, count, &response_data[3]);
 	
-	if(bytes == response_data[2]) // expected payload size
+	if(device->read_contacts)
 	{
 		int i;
 		for(i = 0; i < count; i++)
-		{
-			uint8_t bit = i & 0x7;
-			uint8_t byte = i / 8;
-			uint16_t reg = address + i;
-			uint8_t mask = response_data[3 + byte];
-			
-			bool value = (mask & (1 << bit));
-			device->read_contacts(slave, reg, value);
-		}
+			device->read_contacts(slave, address + i, nyamodbus_bits_get(&response_data[3], i));
 	}
+	
+	return true;
 }
 
 // Parse "read coils" response
@@ -72,29 +233,33 @@ static void nyamodbus_master_parse_read_contacts(str_nyamodbus_master_device * d
 //  request_data: request data
 //  request_size: request data size
 // response_data: response data
-// response_size: response data size
-static void nyamodbus_master_parse_read_coils(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_read_coils(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
 {
 	// Check request info...
 	uint16_t address = get_u16_value(request_data, 2);
 	uint16_t count   = get_u16_value(request_data, 4);
 	uint8_t  bytes = (count + 7) / 8;
 	uint8_t  slave = response_data[0];
+	str_nyamodbus_master_slave * link;
 	
-	if(bytes == response_data[2]) // expected payload size
+	// Expected payload size
+	if((request_size < 6) || (bytes != response_data[2]) || (response_size != 5 + bytes))
+		return false;
+	
+	link = nyamodbus_master_find_slave(device, slave);
+	if(link && link->coils)
+		nyamodbus_bitbank_write(link->coils, address, count, &response_data[3]);
+	
+	if(device->read_coils)
 	{
 		int i;
 		for(i = 0; i < count; i++)
-		{
-			uint8_t bit = i & 0x7;
-			uint8_t byte = i / 8;
-			uint16_t reg = address + i;
-			uint8_t mask = response_data[3 + byte];
-			
-			bool value = (mask & (1 << bit));
-			device->read_coils(slave, reg, value);
-		}
+			device->read_coils(slave, address + i, nyamodbus_bits_get(&response_data[3], i));
 	}
+	
+	return true;
 }
 
 // Parse "read holding" response
@@ -102,8 +267,9 @@ static void nyamodbus_master_parse_read_coils(str_nyamodbus_master_device * devi
 //  request_data: request data
 //  request_size: request data size
 // response_data: response data
-// response_size: response data size
-static void nyamodbus_master_parse_read_holding(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_read_holding(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
 {
 	// Check request info...
 	uint16_t address = get_u16_value(request_data, 2);
@@ -111,27 +277,31 @@ static void nyamodbus_master_parse_read_holding(str_nyamodbus_master_device * de
 	uint8_t  bytes = count * 2;
 	uint8_t  slave = response_data[0];
 	
-	if(bytes == response_data[2]) // expected payload size
+	uint16_t values[NYAMODBUS_MAX_REGISTERS];
+	int i;
+	
+	// Expected payload size
+	if((request_size < 6) || (count > NYAMODBUS_MAX_REGISTERS) || (bytes != response_data[2]) || (response_size != 5 + bytes))
+		return false;
+	
+	if(device->read_holding)
 	{
-		int i;
+		nyamodbus_decode_u16(values, &response_data[3], count);
 		for(i = 0; i < count; i++)
-		{
-			uint16_t byte = 3 + i * 2ul;
-			uint16_t  reg = address + i;
-			
-			uint16_t value = ((uint16_t)response_data[byte] << 8) | response_data[byte + 1];
-			device->read_holding(slave, reg, value);
-		}
+			device->read_holding(slave, address + i, values[i]);
 	}
+	
+	return true;
 }
 
-// Parse "read holding" response
+// Parse "read inputs" response
 //        device: device context
 //  request_data: request data
 //  request_size: request data size
 // response_data: response data
-// response_size: response data size
-static void nyamodbus_master_parse_read_inputs(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_read_inputs(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
 {
 	// Check request info...
 	uint16_t address = get_u16_value(request_data, 2);
@@ -139,18 +309,356 @@ static void nyamodbus_master_parse_read_inputs(str_nyamodbus_master_device * dev
 	uint8_t  bytes = count * 2;
 	uint8_t  slave = response_data[0];
 	
-	if(bytes == response_data[2]) // expected payload size
+	uint16_t values[NYAMODBUS_MAX_REGISTERS];
+	int i;
+	
+	// Expected payload size
+	if((request_size < 6) || (count > NYAMODBUS_MAX_REGISTERS) || (bytes != response_data[2]) || (response_size != 5 + bytes))
+		return false;
+	
+	if(device->read_inputs)
+	{
+		nyamodbus_decode_u16(values, &response_data[3], count);
+		for(i = 0; i < count; i++)
+			device->read_inputs(slave, address + i, values[i]);
+	}
+	
+	return true;
+}
+
+// Stop file transfer and report result
+// device: device context
+//  error: transfer result
+static void nyamodbus_master_transfer_stop(const str_nyamodbus_master_device * device, enum_nyamodbus_error error)
+{
+	str_nyamodbus_master_transfer * transfer = device->transfer;
+	
+	transfer->function = 0;
+	transfer->chunk    = 0;
+	
+	if(device->on_transfer)
+		device->on_transfer(transfer->slave, transfer->done, transfer->total, error);
+}
+
+// Report request error
+//  device: device context
+// command: request data
+//   error: error code
+static void nyamodbus_master_report_error(const str_nyamodbus_master_device * device, const uint8_t * command, enum_nyamodbus_error error)
+{
+	if (device->on_error) 
+		device->on_error(command[0], error);
+	
+	if (device->on_request_error)
+	{
+		uint8_t  function = command[1];
+		uint16_t index    = 0;
+		uint16_t count    = 0;
+		
+		switch(function)
+		{
+			case FUNCTION_WRITE_COIL_SINGLE:
+			case FUNCTION_WRITE_HOLDING_SINGLE:
+			case FUNCTION_MASK_WRITE_HOLDING:
+				index = get_u16_value(command, 2);
+				count = 1;
+				break;
+				
+			case FUNCTION_READ_FIFO:
+			case FUNCTION_DIAGNOSTIC:
+				index = get_u16_value(command, 2);
+				break;
+				
+			case FUNCTION_READ_FILE_RECORD:
+			case FUNCTION_WRITE_FILE_RECORD:
+				// First file number and record
+				index = get_u16_value(command, 4);
+				count = get_u16_value(command, 6);
+				break;
+				
+			case FUNCTION_READ_DEVICE_IDENTIFICATION:
+				break;
+				
+			default:
+				index = get_u16_value(command, 2);
+				count = get_u16_value(command, 4);
+				break;
+		}
+		
+		device->on_request_error(command[0], function, index, count, error);
+	}
+	
+	// Failed request of file transfer
+	if(device->transfer && device->transfer->chunk && (device->transfer->slave == command[0]) && (device->transfer->function == command[1]))
+		nyamodbus_master_transfer_stop(device, error);
+}
+
+// Schedule delayed action
+//  device: device context
+//  action: action to do
+//   usecs: usecs to wait
+static void nyamodbus_master_schedule(const str_nyamodbus_master_device * device, enum_nyamodbus_master_action action, uint32_t usecs)
+{
+	device->state->action   = action;
+	device->state->delay_us = usecs;
+}
+
+// Send stored command
+// device: device context
+static void nyamodbus_master_transmit(const str_nyamodbus_master_device * device)
+{
+	str_nyamodbus_master_state * state = device->state;
+	
+	nyamodbus_send_packet(device->device, state->command, state->size);
+	state->response_measured = false;
+	
+	if(nyamodbus_is_broadcast(state->command[0]))
+	{
+		// No answer, slaves need time to process request
+		nyamodbus_master_schedule(device, MASTER_ACTION_TURNAROUND, NYAMODBUS_BROADCAST_TURNAROUND);
+		
+		if(device->on_complete)
+			device->on_complete(state->command[0], state->command[1]);
+	}
+	else
+	{
+		nyamodbus_start_timeout(device->device);
+		nyamodbus_set_start_timeout(device->device, nyamodbus_master_get_timeout(device, state->command[0]));
+	}
+}
+
+// Clear current request
+// device: device context
+static void nyamodbus_master_finish(const str_nyamodbus_master_device * device)
+{
+	const str_nyamodbus_retry_policy * next_retry = device->state->next_retry;
+	
+	memset(device->state, 0, sizeof(str_nyamodbus_master_state));
+	device->state->next_retry = next_retry;
+}
+
+// Try to schedule repeat of current request
+// device: device context
+//   flag: failure reason (enum_nyamodbus_retry_flags)
+// return: true, if request will be repeated
+static bool nyamodbus_master_retry(const str_nyamodbus_master_device * device, enum_nyamodbus_retry_flags flag)
+{
+	str_nyamodbus_master_state * state = device->state;
+	const str_nyamodbus_retry_policy * policy = state->retry;
+	
+	if(policy && (state->size > 0) && (policy->flags & flag) && (state->attempt < policy->retries) && 
+	   nyamodbus_master_is_online(device, state->command[0]))
+	{
+		uint32_t max_backoff = policy->max_backoff_us ? policy->max_backoff_us : NYAMODBUS_MASTER_MAX_BACKOFF;
+		uint32_t backoff = policy->backoff_us;
+		uint8_t  i;
+		
+		// Bounded exponential backoff
+		for(i = 0; (i < state->attempt) && (backoff < max_backoff); i++)
+			backoff *= 2;
+		
+		if(backoff > max_backoff)
+			backoff = max_backoff;
+		
+		nyamodbus_master_schedule(device, MASTER_ACTION_RESEND, backoff);
+		return true;
+	}
+	
+	return false;
+}
+
+// Process exception response
+// device: device context
+//  error: exception code
+static void nyamodbus_master_on_exception(const str_nyamodbus_master_device * device, enum_nyamodbus_error error)
+{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+	printf("Exception response: %d\n", error);
+#endif
+
+	// Slave can ask to repeat request later
+	if(((error != ERROR_BUSY) && (error != ERROR_LONG_ACTION)) || !nyamodbus_master_retry(device, RETRY_ON_BUSY))
+		nyamodbus_master_report_error(device, device->state->command, error);
+}
+
+// Parse "read/write holding" response
+//        device: device context
+//  request_data: request data
+//  request_size: request data size
+// response_data: response data
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_readwrite_holding(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+{
+	// Check request info...
+	uint16_t address = get_u16_value(request_data, 2);
+	uint16_t count   = get_u16_value(request_data, 4);
+	uint16_t bytes   = count * 2;
+	uint8_t  slave   = response_data[0];
+	
+	uint16_t values[NYAMODBUS_MAX_REGISTERS];
+	int i;
+	
+	// Expected payload size
+	if((request_size < 6) || (count > NYAMODBUS_MAX_REGISTERS) || (bytes != response_data[2]) || (response_size != 5 + bytes))
+		return false;
+	
+	nyamodbus_decode_u16(values, &response_data[3], count);
+	
+	if(device->readwrite_holding)
+		device->readwrite_holding(slave, address, count, values);
+	else if(device->read_holding)
 	{
-		int i;
 		for(i = 0; i < count; i++)
+			device->read_holding(slave, address + i, values[i]);
+	}
+	
+	return true;
+}
+
+// Parse "read FIFO" response
+//        device: device context
+//  request_data: request data
+//  request_size: request data size
+// response_data: response data
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_read_fifo(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+{
+	uint16_t address = get_u16_value(request_data, 2);
+	uint16_t bytes   = get_u16_value(response_data, 2);
+	uint16_t count   = get_u16_value(response_data, 4);
+	uint8_t  slave   = response_data[0];
+	
+	if((request_size < 4) || (response_size < 8) || (count > NYAMODBUS_FIFO_MAX_COUNT) || (bytes != 2 + count * 2) || (response_size != 8 + count * 2))
+		return false;
+	
+	if(device->read_fifo)
+	{
+		uint16_t values[NYAMODBUS_FIFO_MAX_COUNT];
+		
+		nyamodbus_decode_u16(values, &response_data[6], count);
+		device->read_fifo(slave, address, count, values);
+	}
+	
+	return true;
+}
+
+// Check write response (request fields are echoed)
+//  request_data: request data
+// response_data: response data
+// response_size: response data size include crc
+//         bytes: echoed bytes after function code
+// return: true, if response matches request
+static bool nyamodbus_master_check_write(const uint8_t * request_data, const uint8_t * response_data, uint16_t response_size, uint8_t bytes)
+{
+	return (response_size == bytes + 4) && (memcmp(&request_data[2], &response_data[2], bytes) == 0);
+}
+
+// Parse diagnostic response (FC08)
+//        device: device context
+//  request_data: request data
+//  request_size: request data size
+// response_data: response data
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_diagnostic(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+{
+	uint16_t subfunc = get_u16_value(request_data, 2);
+	uint8_t  slave   = response_data[0];
+	
+	if((subfunc == 0x00) || (subfunc == 0x0A))
+	{
+		// Request is echoed
+		if(!nyamodbus_master_check_write(request_data, response_data, response_size, request_size - 2))
+			return false;
+		
+		if(subfunc == 0x00)
+		{
+			str_nyamodbus_master_slave * link = nyamodbus_master_find_slave(device, slave);
+			
+			// Response time of repeated request is ambiguous
+			uint32_t usecs = (device->state->response_measured && (device->state->attempt == 0)) ? device->state->response_us : 0;
+			
+			if(link)
+				link->echo_us = usecs;
+			
+			if(device->on_echo)
+				device->on_echo(slave, usecs);
+		}
+	}
+	else
+	{
+		// SH SL VH VL
+		if((response_size != 8) || (get_u16_value(response_data, 2) != subfunc))
+			return false;
+		
+		if(device->on_diagnostic)
+			device->on_diagnostic(slave, subfunc, get_u16_value(response_data, 4));
+	}
+	
+	return true;
+}
+
+// Parse file records response (FC20, FC21)
+//        device: device context
+//  request_data: request data
+//  request_size: request data size
+// response_data: response data
+// response_size: response data size include crc
+// return: true, if response is valid
+static bool nyamodbus_master_parse_file(str_nyamodbus_master_device * device, const uint8_t * request_data, uint16_t request_size, const uint8_t * response_data, uint16_t response_size)
+{
+	str_nyamodbus_master_transfer * transfer = device->transfer;
+	bool active = transfer && transfer->chunk && (transfer->slave == response_data[0]) && (transfer->function == response_data[1]);
+	
+	if(response_data[1] == FUNCTION_WRITE_FILE_RECORD)
+	{
+		// Request is echoed
+		if(!nyamodbus_master_check_write(request_data, response_data, response_size, request_size - 2))
+			return false;
+	}
+	else
+	{
+		// Subresponses: LEN REF DATA
+		uint32_t index  = active ? transfer->done : 0;
+		uint16_t offset = 3;
+		uint16_t i;
+		
+		if((response_size < 5) || (response_size != 5 + response_data[2]))
+			return false;
+		
+		for(i = 3; i + 7 <= request_size; i += 7)
 		{
-			uint16_t byte = 3 + i * 2ul;
-			uint16_t  reg = address + i;
+			uint16_t count = get_u16_value(request_data, i + 5);
+			
+			if((offset + 2 + (uint32_t)count * 2 > response_size - 2) || 
+			   (response_data[offset] != 1 + count * 2) || (response_data[offset + 1] != NYAMODBUS_FILE_REFERENCE))
+				return false;
+			
+			if(active)
+				memcpy(&transfer->target[index * 2], &response_data[offset + 2], count * 2);
 			
-			uint16_t value = ((uint16_t)response_data[byte] << 8) | response_data[byte + 1];
-			device->read_inputs(slave, reg, value);
+			index  += count;
+			offset += 2 + count * 2;
 		}
+		
+		if(offset != response_size - 2)
+			return false;
+	}
+	
+	if(active)
+	{
+		transfer->done += transfer->chunk;
+		transfer->chunk = 0;
+		
+		if(transfer->done >= transfer->total)
+			nyamodbus_master_transfer_stop(device, ERROR_OK);
+		else if(device->on_transfer)
+			device->on_transfer(transfer->slave, transfer->done, transfer->total, ERROR_OK);
 	}
+	
+	return true;
 }
 
 // Function to parse modbus packet
@@ -164,6 +672,13 @@ static void nyamodbus_master_on_valid_packet(void * context, const uint8_t * dat
 	puts("Valid response!");
 #endif
 
+	// 4 byte frames are parsed for slave requests only (FC07, FC17), shortest response is exception (5 bytes)
+	if(size < 5)
+	{
+		nyamodbus_master_on_timeout(context);
+		return;
+	}
+	
 	if(device->on_response)
 	{
 		if(device->on_response(data[0], data, size))
@@ -171,60 +686,140 @@ static void nyamodbus_master_on_valid_packet(void * context, const uint8_t * dat
 	}
 	
 	// Check data...
-	if (((data[0] == device->state->command[0]) && (device->state->command[0] != 0xFF)) && // Slave ok
+	if (((data[0] == device->state->command[0]) && !nyamodbus_is_broadcast(device->state->command[0])) && // Slave ok
 		((data[1] & 0x7F) == device->state->command[1])) // Func ok
 	{
-		// TODO: check response size!
+		str_nyamodbus_master_slave * slave = nyamodbus_master_find_slave(device, data[0]);
+		if(slave)
+		{
+			// Response time of repeated request is ambiguous
+			if(device->state->response_measured && (device->state->attempt == 0))
+				nyamodbus_master_update_rtt(slave, device->state->response_us);
+			
+			nyamodbus_master_slave_ok(device, slave);
+		}
 		
 		// Parse reesponse...
 		if((data[1] & 0x80) != 0)
 		{
-			// Parse error code
+			// Exception: ADDR FUNC CODE CRC
+			if(size == 5)
+				nyamodbus_master_on_exception(device, (enum_nyamodbus_error)data[2]);
+			else
+				nyamodbus_master_report_error(device, device->state->command, ERROR_INV_RESPONSE);
 		}
 		else
 		{
+			bool valid = true;
+			
 			// Normal response
 			switch(data[1]) // Parse by function...
 			{
 				case FUNCTION_READ_CONTACTS:
-					if(device->read_contacts)
-						nyamodbus_master_parse_read_contacts(device, &device->state->command[0], device->state->size, data, size);
+					valid = nyamodbus_master_parse_read_contacts(device, &device->state->command[0], device->state->size, data, size);
 					break;
 					
 				case FUNCTION_READ_COIL:
-					if(device->read_coils)
-						nyamodbus_master_parse_read_coils(device, &device->state->command[0], device->state->size, data, size);
+					valid = nyamodbus_master_parse_read_coils(device, &device->state->command[0], device->state->size, data, size);
 					break;
 					
 				case FUNCTION_READ_HOLDING:
-					if(device->read_holding)
-						nyamodbus_master_parse_read_holding(device, &device->state->command[0], device->state->size, data, size);
+					valid = nyamodbus_master_parse_read_holding(device, &device->state->command[0], device->state->size, data, size);
 					break;
 					
 				case FUNCTION_READ_INPUTS:
-					if(device->read_inputs)
-						nyamodbus_master_parse_read_inputs(device, &device->state->command[0], device->state->size, data, size);
+					valid = nyamodbus_master_parse_read_inputs(device, &device->state->command[0], device->state->size, data, size);
+					break;
+					
+				case FUNCTION_READWRITE_HOLDING:
+					valid = nyamodbus_master_parse_readwrite_holding(device, &device->state->command[0], device->state->size, data, size);
+					break;
+					
+				case FUNCTION_READ_FIFO:
+					valid = nyamodbus_master_parse_read_fifo(device, &device->state->command[0], device->state->size, data, size);
+					break;
+					
+				case FUNCTION_DIAGNOSTIC:
+					valid = nyamodbus_master_parse_diagnostic(device, &device->state->command[0], device->state->size, data, size);
+					break;
+					
+				case FUNCTION_READ_FILE_RECORD:
+				case FUNCTION_WRITE_FILE_RECORD:
+					valid = nyamodbus_master_parse_file(device, &device->state->command[0], device->state->size, data, size);
+					break;
+					
+				case FUNCTION_WRITE_COIL_SINGLE:
+				case FUNCTION_WRITE_HOLDING_SINGLE:
+				case FUNCTION_WRITE_COIL_MULTI:
+				case FUNCTION_WRITE_HOLDING_MULTI:
+					valid = nyamodbus_master_check_write(&device->state->command[0], data, size, 4);
+					break;
+					
+				case FUNCTION_MASK_WRITE_HOLDING:
+					valid = nyamodbus_master_check_write(&device->state->command[0], data, size, 6);
 					break;
 			}
+			
+			if(!valid)
+				nyamodbus_master_report_error(device, device->state->command, ERROR_INV_RESPONSE);
+			else if(device->on_complete)
+				device->on_complete(data[0], data[1]);
 		}
+		
+		// Request is completed if it is not repeated
+		if(device->state->action == MASTER_ACTION_NONE)
+			nyamodbus_master_finish(device);
 	}
 }
 
-static void nyamodbus_master_on_timeout(void * context)
+// Request failed
+// device: device context
+//  error: error code
+//   flag: failure reason for retry policy
+static void nyamodbus_master_on_failure(const str_nyamodbus_master_device * device, enum_nyamodbus_error error, enum_nyamodbus_retry_flags flag)
 {
-	str_nyamodbus_master_device * device = (str_nyamodbus_master_device *)context;
+	str_nyamodbus_master_slave * slave = nyamodbus_master_find_slave(device, device->state->command[0]);
 	
-	// Generate timeout error
-	if (device->on_error) 
-		device->on_error(device->state->command[0], ERROR_TIMEOUT);
+	if(slave && (device->state->size > 0))
+	{
+		// Back off timeout of silent slave (slow slave without measurement too)
+		if(!device->state->response_measured)
+			slave->timeout_us = nyamodbus_master_limit_timeout(slave->timeout_us * 2);
+		
+		nyamodbus_master_slave_failed(device, slave);
+	}
 	
-	memset(device->state, 0, sizeof(str_nyamodbus_master_state));
-}
+	if(!nyamodbus_master_retry(device, flag))
+	{
+		nyamodbus_master_report_error(device, device->state->command, error);
+		nyamodbus_master_finish(device);
+	}
+}
+
+// Received packet with invalid crc
+static void nyamodbus_master_on_invalid_packet(void * context)
+{
+	nyamodbus_master_on_failure((str_nyamodbus_master_device *)context, ERROR_CRC, RETRY_ON_CRC);
+}
+
+// No answer from slave
+static void nyamodbus_master_on_timeout(void * context)
+{
+	nyamodbus_master_on_failure((str_nyamodbus_master_device *)context, ERROR_TIMEOUT, RETRY_ON_TIMEOUT);
+}
 
 // Any data received
 static void nyamodbus_master_on_data(void * context)
 {
 	str_nyamodbus_master_device * device = (str_nyamodbus_master_device *)context;
+	str_nyamodbus_state * state = device->device->state;
+	
+	// First data of answer
+	if(state->busy && (state->buffer.added == 0) && !device->state->response_measured)
+	{
+		device->state->response_us       = state->elapsed_us;
+		device->state->response_measured = true;
+	}
 	
 	nyamodbus_start_timeout(device->device);
 	nyamodbus_reset_timeout(device->device);
@@ -241,25 +836,212 @@ void nyamodbus_master_main(const str_nyamodbus_master_device * device)
 void nyamodbus_master_reset(const str_nyamodbus_master_device * device)
 {
 	memset(device->state, 0, sizeof(str_nyamodbus_master_state));
-			
+	
+	if(device->queue)
+		memset(device->queue, 0, sizeof(str_nyamodbus_master_queue));
+	
+	if(device->transfer)
+		memset(device->transfer, 0, sizeof(str_nyamodbus_master_transfer));
+	
 	nyamodbus_reset(device->device);
 }
 
-// Send packet
+// Start request
 // device: device context
 //   data: data to send
 //   size: data size
-void nyamodbus_master_send_packet(const str_nyamodbus_master_device * device, const uint8_t * data, uint8_t size)
+//  retry: retry policy of request (optional)
+static void nyamodbus_master_start(const str_nyamodbus_master_device * device, const uint8_t * data, uint8_t size, const str_nyamodbus_retry_policy * retry)
 {
-	if(size <= sizeof(device->state->command))
+	str_nyamodbus_master_slave * slave = nyamodbus_master_find_slave(device, data[0]);
+	
+	if(slave && slave->offline)
 	{
-		uint8_t slave = data[0];
+		// Only probe requests are sent to offline slave
+		if(slave->probe_us < NYAMODBUS_MASTER_PROBE_PERIOD)
+		{
+			nyamodbus_master_report_error(device, data, ERROR_OFFLINE);
+			return;
+		}
 		
+		slave->probe_us = 0;
+	}
+	
+	if(size <= sizeof(device->state->command))
+	{
 		device->state->size = size;
 		memcpy(&device->state->command[0], data, size);
 		
-		nyamodbus_send_packet(device->device, data, size);
-		if(slave != 255) nyamodbus_start_timeout(device->device);
+		device->state->action  = MASTER_ACTION_NONE;
+		device->state->attempt = 0;
+		
+		// Retry policy: request, slave, master or default
+		if(retry)
+			device->state->retry = retry;
+		else if(slave && slave->retry)
+			device->state->retry = slave->retry;
+		else if(device->retry)
+			device->state->retry = device->retry;
+		else
+			device->state->retry = &default_retry;
+		
+		nyamodbus_master_transmit(device);
+	}
+}
+
+// Add request to queue
+// device: device context
+//   data: data to send
+//   size: data size
+//  retry: retry policy of request (optional)
+static void nyamodbus_master_enqueue(const str_nyamodbus_master_device * device, const uint8_t * data, uint8_t size, const str_nyamodbus_retry_policy * retry)
+{
+	str_nyamodbus_master_queue * queue = device->queue;
+	
+	if((queue->count < NYAMODBUS_MASTER_QUEUE_SIZE) && (size <= sizeof(queue->items[0].command)))
+	{
+		str_nyamodbus_master_request * request = &queue->items[(queue->head + queue->count) % NYAMODBUS_MASTER_QUEUE_SIZE];
+		
+		memcpy(request->command, data, size);
+		request->size  = size;
+		request->retry = retry;
+		queue->count++;
+	}
+	else
+		nyamodbus_master_report_error(device, data, ERROR_OVERFLOW);
+}
+
+// Start next request from queue
+// device: device context
+static void nyamodbus_master_dequeue(const str_nyamodbus_master_device * device)
+{
+	str_nyamodbus_master_queue * queue = device->queue;
+	str_nyamodbus_master_request * request = &queue->items[queue->head];
+	
+	queue->head = (queue->head + 1) % NYAMODBUS_MASTER_QUEUE_SIZE;
+	queue->count--;
+	
+	nyamodbus_master_start(device, request->command, request->size, request->retry);
+}
+
+// Send packet
+// device: device context
+//   data: data to send
+//   size: data size
+void nyamodbus_master_send_packet(const str_nyamodbus_master_device * device, const uint8_t * data, uint8_t size)
+{
+	const str_nyamodbus_retry_policy * retry = device->state->next_retry;
+	
+	device->state->next_retry = 0;
+	
+	// Wait for current request if queue is used
+	if(device->queue && nyamodbus_master_is_busy(device))
+		nyamodbus_master_enqueue(device, data, size, retry);
+	else
+		nyamodbus_master_start(device, data, size, retry);
+}
+
+// Send next request of file transfer (max records in request or response)
+// device: device context
+static void nyamodbus_master_transfer_send(const str_nyamodbus_master_device * device)
+{
+	str_nyamodbus_master_transfer * transfer = device->transfer;
+	uint8_t  buffer[NYAMODBUS_FILE_MAX_PACKET];
+	bool     write    = (transfer->function == FUNCTION_WRITE_FILE_RECORD);
+	uint16_t limit    = write ? (3 + 0xFB) : (3 + 0xF5); // max byte count of request/response
+	uint16_t length   = 3;
+	uint16_t response = 3;
+	uint32_t index    = transfer->done;
+	
+	if(limit > sizeof(buffer))
+		limit = sizeof(buffer);
+	
+	while(index < transfer->total)
+	{
+		uint16_t record = index % NYAMODBUS_FILE_MAX_RECORDS;
+		uint32_t count  = transfer->total - index;
+		uint16_t space  = 0;
+		
+		// Subrequest does not cross file end
+		if(count > NYAMODBUS_FILE_MAX_RECORDS - record)
+			count = NYAMODBUS_FILE_MAX_RECORDS - record;
+		
+		// Records are placed to request (write) or response (read)
+		if(write && (length + 9 <= limit))
+			space = (limit - length - 7) / 2;
+		else if(!write && (length + 7 <= limit) && (response + 4 <= limit))
+			space = (limit - response - 2) / 2;
+		
+		if(space == 0)
+			break;
+		
+		if(count > space)
+			count = space;
+		
+		// REF FH FL RH RL CH CL
+		buffer[length] = NYAMODBUS_FILE_REFERENCE;
+		set_u16_value(buffer, length + 1, transfer->file + index / NYAMODBUS_FILE_MAX_RECORDS);
+		set_u16_value(buffer, length + 3, record);
+		set_u16_value(buffer, length + 5, count);
+		length += 7;
+		
+		if(write)
+		{
+			memcpy(&buffer[length], &transfer->source[index * 2], count * 2);
+			length += count * 2;
+		}
+		else
+			response += 2 + count * 2;
+		
+		index += count;
+	}
+	
+	buffer[0] = transfer->slave;
+	buffer[1] = transfer->function;
+	buffer[2] = length - 3;
+	
+	transfer->chunk = index - transfer->done;
+	nyamodbus_master_send_packet(device, buffer, length);
+}
+
+// Process delayed action
+// device: device context
+//  usecs: useconds after last call
+static void nyamodbus_master_process_action(const str_nyamodbus_master_device * device, uint32_t usecs)
+{
+	str_nyamodbus_master_state * state = device->state;
+	
+	if((state->action != MASTER_ACTION_NONE) && !nyamodbus_is_busy(device->device) && !nyamodbus_is_txbusy(device->device))
+	{
+		if(state->delay_us > usecs)
+		{
+			state->delay_us -= usecs;
+		}
+		else
+		{
+			enum_nyamodbus_master_action action = state->action;
+			
+			state->action   = MASTER_ACTION_NONE;
+			state->delay_us = 0;
+			
+			switch(action)
+			{
+				case MASTER_ACTION_RESEND:
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+					printf("Repeat request to slave %d\n", state->command[0]);
+#endif
+					state->attempt++;
+					nyamodbus_master_transmit(device);
+					break;
+					
+				case MASTER_ACTION_TURNAROUND:
+					nyamodbus_master_finish(device);
+					break;
+					
+				default:
+					break;
+			}
+		}
 	}
 }
 
@@ -269,14 +1051,52 @@ void nyamodbus_master_send_packet(const str_nyamodbus_master_device * device, co
 // context: driver context
 void nyamodbus_master_tick(const str_nyamodbus_master_device * device, uint32_t usecs)
 {
+	if(device->slaves)
+	{
+		uint8_t i;
+		for(i = 0; i < device->slave_count; i++)
+		{
+			str_nyamodbus_master_slave * slave = &device->slaves[i];
+			
+			if(slave->offline && (slave->probe_us < NYAMODBUS_MASTER_PROBE_PERIOD))
+				slave->probe_us += usecs;
+		}
+	}
+	
+	nyamodbus_master_process_action(device, usecs);
 	nyamodbus_tick(device->device, &master_driver, (void*)device, usecs);
+	
+	// Next request from queue
+	if(device->queue && (device->queue->count > 0) && !nyamodbus_is_busy(device->device) && (device->state->action == MASTER_ACTION_NONE))
+		nyamodbus_master_dequeue(device);
+	
+	// Next request of file transfer (queued requests are sent first)
+	if(device->transfer && device->transfer->function && !device->transfer->chunk && !nyamodbus_master_is_busy(device))
+		nyamodbus_master_transfer_send(device);
+}
+
+// Number of free places in request queue
+// device: device context
+// return: free places (0 if queue is not used)
+uint8_t nyamodbus_master_queue_free(const str_nyamodbus_master_device * device)
+{
+	return device->queue ? (NYAMODBUS_MASTER_QUEUE_SIZE - device->queue->count) : 0;
+}
+
+// Set retry policy for next request
+// device: device context
+// policy: retry policy
+void nyamodbus_master_set_retry(const str_nyamodbus_master_device * device, const str_nyamodbus_retry_policy * policy)
+{
+	device->state->next_retry = policy;
 }
 
 // Is master busy
 // device: device context
 bool nyamodbus_master_is_busy(const str_nyamodbus_master_device * device)
 {
-	return nyamodbus_is_busy(device->device);
+	return nyamodbus_is_busy(device->device) || (device->state->action != MASTER_ACTION_NONE) ||
+	       (device->queue && (device->queue->count > 0));
 }
 
 // Read coils
@@ -330,6 +1150,53 @@ void nyamodbus_read_holdings(const str_nyamodbus_master_device * device, uint8_t
 	nyamodbus_master_send_packet(device, buffer, 6);
 }
 
+// Send echo request to measure transport time (FC08 subfunction 0x00)
+// device: device context
+//  slave: address of slave device
+//  value: value to echo
+void nyamodbus_echo(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t value)
+{
+	uint8_t buffer[6];
+	
+	buffer[0] = slave;
+	buffer[1] = FUNCTION_DIAGNOSTIC;
+	set_u16_value(buffer, 2, 0x00);
+	set_u16_value(buffer, 4, value);
+	
+	nyamodbus_master_send_packet(device, buffer, 6);
+}
+
+// Read diagnostic counter (FC08 subfunctions 0x0B..0x12) or clear counters (0x0A)
+//      device: device context
+//       slave: address of slave device
+// subfunction: subfunction
+void nyamodbus_read_diagnostic(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t subfunction)
+{
+	uint8_t buffer[6];
+	
+	buffer[0] = slave;
+	buffer[1] = FUNCTION_DIAGNOSTIC;
+	set_u16_value(buffer, 2, subfunction);
+	set_u16_value(buffer, 4, 0x0000);
+	
+	nyamodbus_master_send_packet(device, buffer, 6);
+}
+
+// Read FIFO queue (FC24, max 31 values per request)
+// device: device context
+//  slave: address of slave device
+//  index: FIFO pointer address
+void nyamodbus_read_fifo(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index)
+{
+	uint8_t buffer[4];
+	
+	buffer[0] = slave;
+	buffer[1] = FUNCTION_READ_FIFO;
+	set_u16_value(buffer, 2, index);
+	
+	nyamodbus_master_send_packet(device, buffer, 4);
+}
+
 // Read inputs
 // device: device context
 //  slave: address of slave device
@@ -353,14 +1220,13 @@ void nyamodbus_read_inputs(const str_nyamodbus_master_device * device, uint8_t s
 //  index: holding id
 //  count: holding count
 //   data: register data [count]
-void nyamodbus_write_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count, uint16_t * data)
+void nyamodbus_write_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count, const uint16_t * data)
 {
-	uint16_t buffer_size = 9 + count;
+	uint16_t buffer_size = 9 + count * 2;
 	
 	if(buffer_size <= NYAMODBUS_OUTPUT_BUFFER_SIZE)
 	{
 		uint8_t buffer[NYAMODBUS_OUTPUT_BUFFER_SIZE];
-		int i;
 		
 		buffer[0] = slave;
 		buffer[1] = FUNCTION_WRITE_HOLDING_MULTI;
@@ -368,9 +1234,348 @@ void nyamodbus_write_holdings(const str_nyamodbus_master_device * device, uint8_
 		set_u16_value(buffer, 4, count);
 		buffer[6] = count * 2;
 		
-		for(i = 0; i < count; i++)
-			set_u16_value(buffer, 7 + i * 2, data[i]);
+		nyamodbus_encode_u16(&buffer[7], data, count);
 		
 		nyamodbus_master_send_packet(device, buffer, 7 + count * 2);
 	}
 }
+
+// Change bits of holding: value = (value & and_mask) | (or_mask & ~and_mask)
+//   device: device context
+//    slave: address of slave device
+//    index: holding id
+// and_mask: bits to keep
+//  or_mask: bits to set (from bits not kept)
+void nyamodbus_mask_write_holding(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t and_mask, uint16_t or_mask)
+{
+	uint8_t buffer[8];
+	
+	buffer[0] = slave;
+	buffer[1] = FUNCTION_MASK_WRITE_HOLDING;
+	set_u16_value(buffer, 2, index);
+	set_u16_value(buffer, 4, and_mask);
+	set_u16_value(buffer, 6, or_mask);
+	
+	nyamodbus_master_send_packet(device, buffer, 8);
+}
+
+// Write and read holdings with one request (FC23, write is done before read)
+//       device: device context
+//        slave: address of slave device
+//   read_index: first holding to read
+//   read_count: holding count to read
+//  write_index: first holding to write
+//  write_count: holding count to write
+//         data: register data [write_count]
+void nyamodbus_readwrite_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t read_index, uint16_t read_count, uint16_t write_index, uint16_t write_count, const uint16_t * data)
+{
+	uint16_t buffer_size = 13 + write_count * 2;
+	
+	if(buffer_size <= NYAMODBUS_OUTPUT_BUFFER_SIZE)
+	{
+		uint8_t buffer[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+		
+		buffer[0] = slave;
+		buffer[1] = FUNCTION_READWRITE_HOLDING;
+		set_u16_value(buffer, 2, read_index);
+		set_u16_value(buffer, 4, read_count);
+		set_u16_value(buffer, 6, write_index);
+		set_u16_value(buffer, 8, write_count);
+		buffer[10] = write_count * 2;
+		
+		nyamodbus_encode_u16(&buffer[11], data, write_count);
+		
+		nyamodbus_master_send_packet(device, buffer, 11 + write_count * 2);
+	}
+}
+
+// Write single coil
+// device: device context
+//  slave: address of slave device
+//  index: coil id
+//  value: coil status
+void nyamodbus_write_coil(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, bool value)
+{
+	uint8_t buffer[6];
+	
+	buffer[0] = slave;
+	buffer[1] = FUNCTION_WRITE_COIL_SINGLE;
+	set_u16_value(buffer, 2, index);
+	set_u16_value(buffer, 4, value ? 0xFF00 : 0x0000);
+	
+	nyamodbus_master_send_packet(device, buffer, 6);
+}
+
+// Write single holding
+// device: device context
+//  slave: address of slave device
+//  index: holding id
+//  value: register value
+void nyamodbus_write_holding(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t value)
+{
+	uint8_t buffer[6];
+	
+	buffer[0] = slave;
+	buffer[1] = FUNCTION_WRITE_HOLDING_SINGLE;
+	set_u16_value(buffer, 2, index);
+	set_u16_value(buffer, 4, value);
+	
+	nyamodbus_master_send_packet(device, buffer, 6);
+}
+
+// Write coils
+// device: device context
+//  slave: address of slave device
+//  index: coil id
+//  count: coil count
+//   data: coil status [count]
+void nyamodbus_write_coils(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count, const bool * data)
+{
+	uint16_t bytes = (count + 7) / 8;
+	
+	if(bytes + 9 <= NYAMODBUS_OUTPUT_BUFFER_SIZE)
+	{
+		uint8_t buffer[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+		uint16_t i;
+		
+		buffer[0] = slave;
+		buffer[1] = FUNCTION_WRITE_COIL_MULTI;
+		set_u16_value(buffer, 2, index);
+		set_u16_value(buffer, 4, count);
+		buffer[6] = bytes;
+		
+		memset(&buffer[7], 0, bytes);
+		for(i = 0; i < count; i++)
+		{
+			if(data[i])
+				buffer[7 + i / 8] |= 1 << (i & 0x07);
+		}
+		
+		nyamodbus_master_send_packet(device, buffer, 7 + bytes);
+	}
+}
+
+// Max items in one batch request
+//   coil: coils or holdings
+// return: item count
+static uint16_t nyamodbus_master_batch_limit(bool coil)
+{
+	return coil ? (NYAMODBUS_OUTPUT_BUFFER_SIZE - 9) * 8 : (NYAMODBUS_OUTPUT_BUFFER_SIZE - 9) / 2;
+}
+
+// Is item a placed before item b
+static bool nyamodbus_master_batch_less(const str_nyamodbus_write_item * a, const str_nyamodbus_write_item * b)
+{
+	if(a->coil != b->coil)
+		return a->coil;
+	
+	return a->index < b->index;
+}
+
+// Find end of batch request
+//  items: sorted items
+//  count: item count
+//  start: first item of request
+// return: index after last item of request
+static uint16_t nyamodbus_master_batch_end(const str_nyamodbus_write_item * items, uint16_t count, uint16_t start)
+{
+	uint16_t limit = nyamodbus_master_batch_limit(items[start].coil);
+	uint16_t span  = 1;
+	uint16_t end   = start + 1;
+	
+	while(end < count)
+	{
+		const str_nyamodbus_write_item * prev = &items[end - 1];
+		const str_nyamodbus_write_item * item = &items[end];
+		
+		if(item->coil != prev->coil)
+			break;
+		
+		if(item->index != prev->index)
+		{
+			if((item->index != prev->index + 1) || (span >= limit))
+				break;
+			
+			span++;
+		}
+		
+		end++;
+	}
+	
+	return end;
+}
+
+// Send batch request
+// device: device context
+//  slave: address of slave device
+//  items: sorted items of request
+//  count: item count
+static void nyamodbus_master_batch_send(const str_nyamodbus_master_device * device, uint8_t slave, const str_nyamodbus_write_item * items, uint16_t count)
+{
+	uint16_t first = items[0].index;
+	uint16_t span  = items[count - 1].index - first + 1;
+	
+	if(span == 1)
+	{
+		if(items[0].coil)
+			nyamodbus_write_coil(device, slave, first, items[count - 1].value != 0);
+		else
+			nyamodbus_write_holding(device, slave, first, items[count - 1].value);
+	}
+	else if(items[0].coil)
+	{
+		uint8_t  buffer[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+		uint16_t bytes = (span + 7) / 8;
+		uint16_t i;
+		
+		buffer[0] = slave;
+		buffer[1] = FUNCTION_WRITE_COIL_MULTI;
+		set_u16_value(buffer, 2, first);
+		set_u16_value(buffer, 4, span);
+		buffer[6] = bytes;
+		
+		// Equal items are overwritten by last
+		memset(&buffer[7], 0, bytes);
+		for(i = 0; i < count; i++)
+		{
+			uint16_t bit = items[i].index - first;
+			
+			if(items[i].value)
+				buffer[7 + bit / 8] |= 1 << (bit & 0x07);
+			else
+				buffer[7 + bit / 8] &= ~(1 << (bit & 0x07));
+		}
+		
+		nyamodbus_master_send_packet(device, buffer, 7 + bytes);
+	}
+	else
+	{
+		uint16_t values[(NYAMODBUS_OUTPUT_BUFFER_SIZE - 9) / 2];
+		uint16_t i;
+		
+		for(i = 0; i < count; i++)
+			values[items[i].index - first] = items[i].value;
+		
+		nyamodbus_write_holdings(device, slave, first, span, values);
+	}
+}
+
+// Write scattered coils and holdings with fewest requests
+// (FC05/FC06 for single items, FC15/FC16 for ranges of neighbour items)
+// device: device context
+//  slave: address of slave device
+//  items: items to write [count], sorted in place (for equal items last value is written)
+//  count: item count
+// return: number of requests, 0 if requests cannot be queued (nothing is sent)
+uint8_t nyamodbus_write_batch(const str_nyamodbus_master_device * device, uint8_t slave, str_nyamodbus_write_item * items, uint16_t count)
+{
+	uint16_t requests = 0;
+	uint16_t places;
+	uint16_t i;
+	
+	if(count == 0)
+		return 0;
+	
+	// Stable insertion sort: by type, then by index
+	for(i = 1; i < count; i++)
+	{
+		str_nyamodbus_write_item item = items[i];
+		uint16_t j = i;
+		
+		while((j > 0) && nyamodbus_master_batch_less(&item, &items[j - 1]))
+		{
+			items[j] = items[j - 1];
+			j--;
+		}
+		
+		items[j] = item;
+	}
+	
+	for(i = 0; i < count; i = nyamodbus_master_batch_end(items, count, i))
+		requests++;
+	
+	// First request is sent immediately if master is free
+	places = nyamodbus_master_queue_free(device) + (nyamodbus_master_is_busy(device) ? 0 : 1);
+	if(requests > places)
+		return 0;
+	
+	for(i = 0; i < count; )
+	{
+		uint16_t end = nyamodbus_master_batch_end(items, count, i);
+		
+		nyamodbus_master_batch_send(device, slave, &items[i], end - i);
+		i = end;
+	}
+	
+	return requests;
+}
+
+// Start file transfer
+//   device: device context
+//    slave: address of slave device
+//     file: first file number
+// function: FUNCTION_READ_FILE_RECORD or FUNCTION_WRITE_FILE_RECORD
+//   source: records to write
+//   target: buffer for readed records
+//  records: record count
+//   return: true, if transfer is started
+static bool nyamodbus_master_transfer_start(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t file, uint8_t function, const uint8_t * source, uint8_t * target, uint32_t records)
+{
+	str_nyamodbus_master_transfer * transfer = device->transfer;
+	
+	if(!transfer || transfer->function || (records == 0) || nyamodbus_is_broadcast(slave) ||
+	   ((uint32_t)file + (records - 1) / NYAMODBUS_FILE_MAX_RECORDS > 0xFFFF))
+		return false;
+	
+	transfer->slave    = slave;
+	transfer->file     = file;
+	transfer->total    = records;
+	transfer->done     = 0;
+	transfer->chunk    = 0;
+	transfer->source   = source;
+	transfer->target   = target;
+	transfer->function = function;
+	return true;
+}
+
+// Start file write (FC21), records are packed to max requests size, transfer is continued by nyamodbus_master_tick
+//  device: device context
+//   slave: address of slave device
+//    file: first file number (next file is used after record 9999)
+//    data: records [records * 2] in packet byte order (big endian), must be valid until transfer is finished
+// records: record count
+//  return: true, if transfer is started
+bool nyamodbus_write_file(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t file, const uint8_t * data, uint32_t records)
+{
+	return nyamodbus_master_transfer_start(device, slave, file, FUNCTION_WRITE_FILE_RECORD, data, 0, records);
+}
+
+// Start file read (FC20), records are packed to max requests size, transfer is continued by nyamodbus_master_tick
+//  device: device context
+//   slave: address of slave device
+//    file: first file number (next file is used after record 9999)
+//    data: buffer for records [records * 2] in packet byte order (big endian)
+// records: record count
+//  return: true, if transfer is started
+bool nyamodbus_read_file(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t file, uint8_t * data, uint32_t records)
+{
+	return nyamodbus_master_transfer_start(device, slave, file, FUNCTION_READ_FILE_RECORD, 0, data, records);
+}
+
+// Stop file transfer (sent request is completed)
+// device: device context
+void nyamodbus_transfer_abort(const str_nyamodbus_master_device * device)
+{
+	if(device->transfer)
+	{
+		device->transfer->function = 0;
+		device->transfer->chunk    = 0;
+	}
+}
+
+// Is file transfer active
+// device: device context
+bool nyamodbus_transfer_is_active(const str_nyamodbus_master_device * device)
+{
+	return device->transfer && (device->transfer->function != 0);
+}
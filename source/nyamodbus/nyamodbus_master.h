@@ -9,6 +9,7 @@
 #define _NYAMODBUS_MASTER_H
 
 #include "nyamodbus.h"
+#include "nyamodbus_bits.h"
 	
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +21,12 @@ extern "C" {
 	// Analog read (holding, input)
 	typedef void (*nyam_master_analog_read)(uint8_t slave, uint16_t index, uint16_t value);
 	
+	// Analog block read (readed registers of read/write request)
+	// index: first register
+	// count: register count
+	// values: register values [count]
+	typedef void (*nyam_master_analog_block)(uint8_t slave, uint16_t index, uint16_t count, const uint16_t * values);
+	
 	// Device info respinse handler
 	// index: index of string
 	//  info: information string
@@ -32,6 +39,155 @@ extern "C" {
 	// Error code handler
 	typedef void (*nyam_request_error)(uint8_t slave,enum_nyamodbus_error error);
 	
+	// Request completed handler (answer is received or broadcast request is sent)
+	//    slave: address of slave device
+	// function: function code of request
+	typedef void (*nyam_request_complete)(uint8_t slave, uint8_t function);
+	
+	// Slave status handler
+	//  slave: address of slave device
+	// online: true if slave answers again, false if slave is marked offline
+	typedef void (*nyam_slave_status)(uint8_t slave, bool online);
+	
+	// Request error handler (exception response or timeout)
+	//    slave: address of slave device
+	// function: function code of request
+	//    index: first register/coil of request
+	//    count: register/coil count of request
+	//    error: error code
+	typedef void (*nyam_request_failed)(uint8_t slave, uint8_t function, uint16_t index, uint16_t count, enum_nyamodbus_error error);
+	
+	// Diagnostic counter handler (FC08)
+	//       slave: address of slave device
+	// subfunction: counter subfunction (0x0B..0x12)
+	//       value: counter value
+	typedef void (*nyam_master_diagnostic)(uint8_t slave, uint16_t subfunction, uint16_t value);
+	
+	// Echo handler (FC08 return query data)
+	// slave: address of slave device
+	// usecs: usecs from request to first byte of answer (0 - not measured)
+	typedef void (*nyam_master_echo)(uint8_t slave, uint32_t usecs);
+	
+	// File transfer progress handler
+	//  slave: address of slave device
+	//   done: transferred records
+	//  total: record count of transfer
+	//  error: error code (transfer is stopped if not ERROR_OK, transfer is finished if done == total)
+	typedef void (*nyam_transfer_progress)(uint8_t slave, uint32_t done, uint32_t total, enum_nyamodbus_error error);
+	
+	// Conditions to repeat request
+	typedef enum {
+		RETRY_ON_TIMEOUT = 0x01, // No answer
+		RETRY_ON_CRC     = 0x02, // Answer with invalid crc
+		RETRY_ON_BUSY    = 0x04  // Slave answers ERROR_BUSY
+	} enum_nyamodbus_retry_flags;
+	
+	// Request retry policy
+	typedef struct
+	{
+		// Max repeats of request
+		uint8_t    retries;
+		// Usecs to wait before first repeat, doubled for each next repeat
+		uint32_t   backoff_us;
+		// Max usecs to wait before repeat (0 - NYAMODBUS_MASTER_MAX_BACKOFF)
+		uint32_t   max_backoff_us;
+		// Conditions to repeat request (enum_nyamodbus_retry_flags)
+		uint8_t    flags;
+	} str_nyamodbus_retry_policy;
+	
+	// Write request item for batch
+	typedef struct
+	{
+		// Coil (true) or holding register (false)
+		bool       coil;
+		// Index of coil or register
+		uint16_t   index;
+		// Value (0 or 1 for coil)
+		uint16_t   value;
+	} str_nyamodbus_write_item;
+	
+	// File transfer state (FC20/FC21)
+	typedef struct
+	{
+		// Address of slave device
+		uint8_t    slave;
+		// FUNCTION_READ_FILE_RECORD or FUNCTION_WRITE_FILE_RECORD (0 - no transfer)
+		uint8_t    function;
+		// First file number, next file is used after record 9999
+		uint16_t   file;
+		// Record count of transfer
+		uint32_t   total;
+		// Transferred records
+		uint32_t   done;
+		// Records in sent request (0 - no request)
+		uint16_t   chunk;
+		// Records to write [total * 2] in packet byte order
+		const uint8_t * source;
+		// Readed records [total * 2] in packet byte order
+		uint8_t *  target;
+	} str_nyamodbus_master_transfer;
+	
+	// Delayed master action
+	typedef enum {
+		MASTER_ACTION_NONE,
+		MASTER_ACTION_RESEND,
+		MASTER_ACTION_TURNAROUND
+	} enum_nyamodbus_master_action;
+	
+	// Slave link state
+	typedef struct
+	{
+		// Address of slave device
+		uint8_t    address;
+		
+		// Smoothed response time, usecs (0 - not measured)
+		uint32_t   srtt_us;
+		// Response time variation, usecs
+		uint32_t   rttvar_us;
+		// Usecs to wait start of answer (initial value can be set, 0 - NYAMODBUS_PACKET_START_TIMEOUT)
+		uint32_t   timeout_us;
+		
+		// Failed requests in a row
+		uint8_t    failures;
+		// Slave is not answering, only probe requests are sent
+		bool       offline;
+		// Usecs after last probe request
+		uint32_t   probe_us;
+		
+		// Last echo response time, usecs (0 - not measured)
+		uint32_t   echo_us;
+		
+		// Retry policy for slave requests (optional)
+		const str_nyamodbus_retry_policy * retry;
+		
+		// Image of slave contacts, updated by read responses (optional)
+		const str_nyamodbus_bitbank *      contacts;
+		// Image of slave coils, updated by read responses (optional)
+		const str_nyamodbus_bitbank *      coils;
+	} str_nyamodbus_master_slave;
+	
+	// Queued request
+	typedef struct
+	{
+		// Request data
+		uint8_t    command[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+		// Request size
+		uint8_t    size;
+		// Retry policy of request
+		const str_nyamodbus_retry_policy * retry;
+	} str_nyamodbus_master_request;
+	
+	// Request queue
+	typedef struct
+	{
+		// Requests
+		str_nyamodbus_master_request items[NYAMODBUS_MASTER_QUEUE_SIZE];
+		// Index of first request
+		uint8_t    head;
+		// Number of requests
+		uint8_t    count;
+	} str_nyamodbus_master_queue;
+	
 	// Master state
 	typedef struct
 	{
@@ -39,6 +195,22 @@ extern "C" {
 		uint8_t    command[NYAMODBUS_OUTPUT_BUFFER_SIZE];
 		// Send buffer size
 		uint8_t    size;
+		
+		// Delayed action
+		enum_nyamodbus_master_action action;
+		// Usecs before delayed action
+		uint32_t   delay_us;
+		// Repeats of current request
+		uint8_t    attempt;
+		// Retry policy of current request
+		const str_nyamodbus_retry_policy * retry;
+		// Retry policy for next request (optional)
+		const str_nyamodbus_retry_policy * next_retry;
+		
+		// Usecs from request to first byte of answer
+		uint32_t   response_us;
+		// Is response time measured for current request
+		bool       response_measured;
 	} str_nyamodbus_master_state;
 	
 	// Master device context
@@ -50,12 +222,32 @@ extern "C" {
 		// Pointer to modbus master state
 		str_nyamodbus_master_state * state;
 		
+		// Request queue (optional)
+		str_nyamodbus_master_queue * queue;
+		
+		// Slaves with adaptive timeouts (optional)
+		str_nyamodbus_master_slave * slaves;
+		// Number of slaves
+		uint8_t                      slave_count;
+		
+		// Retry policy for all requests (optional)
+		const str_nyamodbus_retry_policy * retry;
+		
 		// Respone received
 		nyam_response                on_response;
 		
 		// Error code
 		nyam_request_error           on_error;
 		
+		// Error code with request info
+		nyam_request_failed          on_request_error;
+		
+		// Slave goes offline or online
+		nyam_slave_status            on_slave_status;
+		
+		// Request completed
+		nyam_request_complete        on_complete;
+		
 		// Contacts read handler
 		nyam_master_digital_read     read_contacts;
 		
@@ -67,6 +259,24 @@ extern "C" {
 		
 		// Holding read handler
 		nyam_master_analog_read      read_holding;
+		
+		// Read/write holding handler (read_holding is used if not set)
+		nyam_master_analog_block     readwrite_holding;
+		
+		// FIFO read handler (index - FIFO pointer address, values are removed from slave queue)
+		nyam_master_analog_block     read_fifo;
+		
+		// File transfer state (optional)
+		str_nyamodbus_master_transfer * transfer;
+		
+		// File transfer progress
+		nyam_transfer_progress       on_transfer;
+		
+		// Diagnostic counter handler
+		nyam_master_diagnostic       on_diagnostic;
+		
+		// Echo handler
+		nyam_master_echo             on_echo;
 	} str_nyamodbus_master_device;
 	
 	// Init modbus state
@@ -91,6 +301,28 @@ extern "C" {
 	// device: device context
 	bool nyamodbus_master_is_busy(const str_nyamodbus_master_device * device);
 
+	// Get usecs to wait start of answer from slave
+	// device: device context
+	//  slave: address of slave device
+	// return: timeout
+	uint32_t nyamodbus_master_get_timeout(const str_nyamodbus_master_device * device, uint8_t slave);
+
+	// Is slave online (answers to requests)
+	// device: device context
+	//  slave: address of slave device
+	// return: false if slave is marked offline
+	bool nyamodbus_master_is_online(const str_nyamodbus_master_device * device, uint8_t slave);
+
+	// Number of free places in request queue
+	// device: device context
+	// return: free places (0 if queue is not used)
+	uint8_t nyamodbus_master_queue_free(const str_nyamodbus_master_device * device);
+
+	// Set retry policy for next request
+	// device: device context
+	// policy: retry policy
+	void nyamodbus_master_set_retry(const str_nyamodbus_master_device * device, const str_nyamodbus_retry_policy * policy);
+
 	// Read coils
 	// device: device context
 	//  slave: address of slave device
@@ -112,6 +344,24 @@ extern "C" {
 	//  count: holding count
 	void nyamodbus_read_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count);
 
+	// Send echo request to measure transport time (FC08 subfunction 0x00)
+	// device: device context
+	//  slave: address of slave device
+	//  value: value to echo
+	void nyamodbus_echo(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t value);
+
+	// Read diagnostic counter (FC08 subfunctions 0x0B..0x12) or clear counters (0x0A)
+	//      device: device context
+	//       slave: address of slave device
+	// subfunction: subfunction
+	void nyamodbus_read_diagnostic(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t subfunction);
+
+	// Read FIFO queue (FC24, max 31 values per request)
+	// device: device context
+	//  slave: address of slave device
+	//  index: FIFO pointer address
+	void nyamodbus_read_fifo(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index);
+
 	// Read inputs
 	// device: device context
 	//  slave: address of slave device
@@ -119,13 +369,88 @@ extern "C" {
 	//  count: input count
 	void nyamodbus_read_inputs(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count);
 
+	// Write single coil
+	// device: device context
+	//  slave: address of slave device
+	//  index: coil id
+	//  value: coil status
+	void nyamodbus_write_coil(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, bool value);
+
+	// Write single holding
+	// device: device context
+	//  slave: address of slave device
+	//  index: holding id
+	//  value: register value
+	void nyamodbus_write_holding(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t value);
+
+	// Write coils
+	// device: device context
+	//  slave: address of slave device
+	//  index: coil id
+	//  count: coil count
+	//   data: coil status [count]
+	void nyamodbus_write_coils(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count, const bool * data);
+
 	// Write holding
 	// device: device context
 	//  slave: address of slave device
 	//  index: holding id
 	//  count: holding count
 	//   data: register data [count]
-	void nyamodbus_write_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count, uint16_t * data);
+	void nyamodbus_write_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t count, const uint16_t * data);
+
+	// Change bits of holding: value = (value & and_mask) | (or_mask & ~and_mask)
+	//   device: device context
+	//    slave: address of slave device
+	//    index: holding id
+	// and_mask: bits to keep
+	//  or_mask: bits to set (from bits not kept)
+	void nyamodbus_mask_write_holding(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t index, uint16_t and_mask, uint16_t or_mask);
+
+	// Write and read holdings with one request (FC23, write is done before read)
+	//       device: device context
+	//        slave: address of slave device
+	//   read_index: first holding to read
+	//   read_count: holding count to read
+	//  write_index: first holding to write
+	//  write_count: holding count to write
+	//         data: register data [write_count]
+	void nyamodbus_readwrite_holdings(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t read_index, uint16_t read_count, uint16_t write_index, uint16_t write_count, const uint16_t * data);
+
+	// Write scattered coils and holdings with fewest requests
+	// (FC05/FC06 for single items, FC15/FC16 for ranges of neighbour items)
+	// device: device context
+	//  slave: address of slave device
+	//  items: items to write [count], sorted in place (for equal items last value is written)
+	//  count: item count
+	// return: number of requests, 0 if requests cannot be queued (nothing is sent)
+	uint8_t nyamodbus_write_batch(const str_nyamodbus_master_device * device, uint8_t slave, str_nyamodbus_write_item * items, uint16_t count);
+
+	// Start file write (FC21), records are packed to max requests size, transfer is continued by nyamodbus_master_tick
+	//  device: device context
+	//   slave: address of slave device
+	//    file: first file number (next file is used after record 9999)
+	//    data: records [records * 2] in packet byte order (big endian), must be valid until transfer is finished
+	// records: record count
+	//  return: true, if transfer is started
+	bool nyamodbus_write_file(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t file, const uint8_t * data, uint32_t records);
+
+	// Start file read (FC20), records are packed to max requests size, transfer is continued by nyamodbus_master_tick
+	//  device: device context
+	//   slave: address of slave device
+	//    file: first file number (next file is used after record 9999)
+	//    data: buffer for records [records * 2] in packet byte order (big endian)
+	// records: record count
+	//  return: true, if transfer is started
+	bool nyamodbus_read_file(const str_nyamodbus_master_device * device, uint8_t slave, uint16_t file, uint8_t * data, uint32_t records);
+
+	// Stop file transfer (sent request is completed)
+	// device: device context
+	void nyamodbus_transfer_abort(const str_nyamodbus_master_device * device);
+
+	// Is file transfer active
+	// device: device context
+	bool nyamodbus_transfer_is_active(const str_nyamodbus_master_device * device);
 
 #ifdef __cplusplus
 };
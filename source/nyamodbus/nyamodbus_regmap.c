@@ -0,0 +1,367 @@
+//
+// Nyamodbus library register map v1.1.0
+//
+
+#include "nyamodbus_regmap.h"
+#include <string.h>
+#include <stdio.h>
+
+// Registers of locked ranges are accessed with atomic operations
+#if defined(__GNUC__)
+	#define REGMAP_LOAD(ptr)          __atomic_load_n(ptr, __ATOMIC_RELAXED)
+	#define REGMAP_STORE(ptr, value)  __atomic_store_n(ptr, value, __ATOMIC_RELAXED)
+	#define REGMAP_SEQ_LOAD(ptr)      __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+	#define REGMAP_SEQ_STORE(ptr, v)  __atomic_store_n(ptr, v, __ATOMIC_RELEASE)
+	#define REGMAP_SEQ_CLAIM(ptr, v)  __atomic_compare_exchange_n(ptr, v, *(v) + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)
+	#define REGMAP_FENCE_ACQUIRE()    __atomic_thread_fence(__ATOMIC_ACQUIRE)
+	#define REGMAP_FENCE_RELEASE()    __atomic_thread_fence(__ATOMIC_RELEASE)
+#else
+	// Single core without reordering: volatile sequence access is enough
+	#define REGMAP_LOAD(ptr)          (*(volatile const uint16_t *)(ptr))
+	#define REGMAP_STORE(ptr, value)  (*(volatile uint16_t *)(ptr) = (value))
+	#define REGMAP_SEQ_LOAD(ptr)      (*(volatile const uint32_t *)(ptr))
+	#define REGMAP_SEQ_STORE(ptr, v)  (*(volatile uint32_t *)(ptr) = (v))
+	#define REGMAP_SEQ_CLAIM(ptr, v)  (REGMAP_SEQ_STORE(ptr, *(v) + 1), true)
+	#define REGMAP_FENCE_ACQUIRE()
+	#define REGMAP_FENCE_RELEASE()
+#endif
+
+// Find index of range with register (binary search)
+//     map: register map
+// address: register index
+//  return: range index or map->count, if register is not mapped
+static uint16_t nyamodbus_regmap_index(const str_nyamodbus_regmap * map, uint16_t address)
+{
+	uint16_t low  = 0;
+	uint16_t high = map->count;
+	
+	// Find first range with start > address
+	while(low < high)
+	{
+		uint16_t middle = low + (high - low) / 2;
+		
+		if(map->ranges[middle].start <= address)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	
+	if(low > 0)
+	{
+		const str_nyamodbus_regmap_range * range = &map->ranges[low - 1];
+		
+		if((uint32_t)address < (uint32_t)range->start + range->count)
+			return low - 1;
+	}
+	
+	return map->count;
+}
+
+// Check access to registers
+//    map: register map
+//  start: index of first register
+//  count: register count
+//  flags: required access flags (all of them)
+//  first: index of range with first register
+// return: error code
+static enum_nyamodbus_error nyamodbus_regmap_access(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count, uint8_t flags, uint16_t * first)
+{
+	uint32_t address = start;
+	uint32_t end     = (uint32_t)start + count;
+	uint16_t index;
+	
+	if((map == 0) || (count == 0))
+		return ERROR_INV_REQ_VALUE;
+	
+	index  = nyamodbus_regmap_index(map, start);
+	*first = index;
+	
+	while(address < end)
+	{
+		const str_nyamodbus_regmap_range * range;
+		
+		// Registers must be mapped without gaps
+		if((index >= map->count) || (map->ranges[index].start > address))
+			return ERROR_NO_DATAADDRESS;
+		
+		range = &map->ranges[index];
+		if((range->flags & flags) != flags)
+			return ERROR_NO_DATAADDRESS;
+		
+		// Locked range is updated by producer without generation change: it is never cached
+		if((flags & REGMAP_CACHED) && range->lock)
+			return ERROR_NO_DATAADDRESS;
+		
+		// Writable range without generation: cached response would not be invalidated
+		if((flags & REGMAP_CACHED) && (range->flags & REGMAP_WRITE) && !map->generation)
+			return ERROR_NO_DATAADDRESS;
+		
+		address = (uint32_t)range->start + range->count;
+		index++;
+	}
+	
+	return ERROR_OK;
+}
+
+// Start update of locked registers (writer)
+// lock: sequence lock
+void nyamodbus_seqlock_write_begin(str_nyamodbus_seqlock * lock)
+{
+	uint32_t sequence = REGMAP_SEQ_LOAD(&lock->sequence);
+	
+	// Odd sequence: readers will retry. Writers are serialized: sequence is claimed only if it is even
+	while((sequence & 1) || !REGMAP_SEQ_CLAIM(&lock->sequence, &sequence))
+		sequence = REGMAP_SEQ_LOAD(&lock->sequence);
+	
+	REGMAP_FENCE_RELEASE();
+}
+
+// Finish update of locked registers (writer, after nyamodbus_seqlock_write_begin)
+// lock: sequence lock
+void nyamodbus_seqlock_write_end(str_nyamodbus_seqlock * lock)
+{
+	uint32_t sequence = REGMAP_SEQ_LOAD(&lock->sequence);
+	
+	REGMAP_SEQ_STORE(&lock->sequence, sequence + 1);
+}
+
+// Publish registers of range without blocking readers (producer thread)
+//  range: register range
+// offset: offset of first register in range
+//  count: register count
+// values: registers [count]
+void nyamodbus_regmap_publish(const str_nyamodbus_regmap_range * range, uint16_t offset, uint16_t count, const uint16_t * values)
+{
+	uint16_t i;
+	
+	if(range->lock)
+	{
+		nyamodbus_seqlock_write_begin(range->lock);
+		for(i = 0; i < count; i++)
+			REGMAP_STORE(&range->data[offset + i], values[i]);
+		nyamodbus_seqlock_write_end(range->lock);
+	}
+	else
+		memcpy(&range->data[offset], values, count * sizeof(uint16_t));
+}
+
+// Copy registers of range in one consistent pass (any thread)
+//  range: register range
+// offset: offset of first register in range
+//  count: register count
+// values: registers [count]
+void nyamodbus_regmap_snapshot(const str_nyamodbus_regmap_range * range, uint16_t offset, uint16_t count, uint16_t * values)
+{
+	uint32_t sequence;
+	uint16_t i;
+	
+	if(range->lock)
+	{
+		do
+		{
+			// Wait for writer
+			while((sequence = REGMAP_SEQ_LOAD(&range->lock->sequence)) & 1)
+				;
+			
+			for(i = 0; i < count; i++)
+				values[i] = REGMAP_LOAD(&range->data[offset + i]);
+			
+			REGMAP_FENCE_ACQUIRE();
+		}
+		while(REGMAP_SEQ_LOAD(&range->lock->sequence) != sequence);
+	}
+	else
+		memcpy(values, &range->data[offset], count * sizeof(uint16_t));
+}
+
+// Check register map (ranges are sorted and not overlapped, locked ranges are not cached, cached writable ranges need generation)
+//    map: register map
+// return: true, if map is valid
+bool nyamodbus_regmap_check(const str_nyamodbus_regmap * map)
+{
+	uint16_t i;
+	
+	for(i = 0; i < map->count; i++)
+	{
+		const str_nyamodbus_regmap_range * range = &map->ranges[i];
+		
+		if((range->count == 0) || (range->data == 0) || ((uint32_t)range->start + range->count > 0x10000))
+		{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			printf("Regmap: invalid range %04x (%d)\n", range->start, range->count);
+#endif
+			return false;
+		}
+		
+		if((range->flags & REGMAP_CACHED) && range->lock)
+		{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			printf("Regmap: locked range %04x can not be cached\n", range->start);
+#endif
+			return false;
+		}
+		
+		if((range->flags & REGMAP_CACHED) && (range->flags & REGMAP_WRITE) && !map->generation)
+		{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			printf("Regmap: writable range %04x can not be cached without generation\n", range->start);
+#endif
+			return false;
+		}
+		
+		if((i > 0) && ((uint32_t)map->ranges[i - 1].start + map->ranges[i - 1].count > range->start))
+		{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			printf("Regmap: range %04x is unsorted or overlapped\n", range->start);
+#endif
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+// Find range with register
+//     map: register map
+// address: register index
+//  return: range or 0, if register is not mapped
+const str_nyamodbus_regmap_range * nyamodbus_regmap_find(const str_nyamodbus_regmap * map, uint16_t address)
+{
+	uint16_t index = nyamodbus_regmap_index(map, address);
+	
+	return (index < map->count) ? &map->ranges[index] : 0;
+}
+
+// Is registers can be cached (all ranges are readable, have REGMAP_CACHED flag and no lock, writable ranges need generation)
+//    map: register map
+//  start: index of first register
+//  count: register count
+// return: true, if response can be cached
+bool nyamodbus_regmap_is_cached(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count)
+{
+	uint16_t first;
+	
+	// One pass: all ranges must be readable and cached
+	return nyamodbus_regmap_access(map, start, count, REGMAP_READ | REGMAP_CACHED, &first) == ERROR_OK;
+}
+
+// Check read access to registers (registers are not readed)
+//    map: register map
+//  start: index of first register
+//  count: register count
+// return: error code
+enum_nyamodbus_error nyamodbus_regmap_check_read(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count)
+{
+	uint16_t first;
+	
+	return nyamodbus_regmap_access(map, start, count, REGMAP_READ, &first);
+}
+
+// Get generation of map data
+//    map: register map
+// return: generation
+uint32_t nyamodbus_regmap_generation(const str_nyamodbus_regmap * map)
+{
+	return map->generation ? REGMAP_SEQ_LOAD(map->generation) : 0;
+}
+
+// Data of map was changed: cached responses are invalid (can be called from any thread)
+// map: register map
+void nyamodbus_regmap_invalidate(const str_nyamodbus_regmap * map)
+{
+	if(map->generation)
+	{
+#if defined(__GNUC__)
+		__atomic_add_fetch(map->generation, 1, __ATOMIC_RELEASE);
+#else
+		REGMAP_SEQ_STORE(map->generation, REGMAP_SEQ_LOAD(map->generation) + 1);
+#endif
+	}
+}
+
+// Read registers (request can span adjacent ranges)
+//    map: register map
+//  start: index of first register
+//  count: register count
+// values: registers [count]
+// return: error code
+enum_nyamodbus_error nyamodbus_regmap_read(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count, uint16_t * values)
+{
+	uint16_t index;
+	enum_nyamodbus_error error = nyamodbus_regmap_access(map, start, count, REGMAP_READ, &index);
+	
+	while((error == ERROR_OK) && (count > 0))
+	{
+		const str_nyamodbus_regmap_range * range = &map->ranges[index++];
+		uint16_t offset = start - range->start;
+		uint16_t part   = range->count - offset;
+		
+		if(part > count)
+			part = count;
+		
+		if(range->on_read)
+			range->on_read(start, part);
+		
+		nyamodbus_regmap_snapshot(range, offset, part, values);
+		
+		values += part;
+		start  += part;
+		count  -= part;
+	}
+	
+	return error;
+}
+
+// Write registers (request can span adjacent ranges, nothing is written on error)
+//    map: register map
+//  start: index of first register
+//  count: register count
+// values: registers [count]
+// return: error code
+enum_nyamodbus_error nyamodbus_regmap_write(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count, const uint16_t * values)
+{
+	uint16_t first;
+	uint8_t  pass;
+	enum_nyamodbus_error error = nyamodbus_regmap_access(map, start, count, REGMAP_WRITE, &first);
+	
+	// Pass 0: validate all ranges, pass 1: commit
+	for(pass = 0; (pass < 2) && (error == ERROR_OK); pass++)
+	{
+		uint16_t index   = first;
+		uint16_t address = start;
+		uint16_t left    = count;
+		const uint16_t * data = values;
+		
+		while((error == ERROR_OK) && (left > 0))
+		{
+			const str_nyamodbus_regmap_range * range = &map->ranges[index++];
+			uint16_t offset = address - range->start;
+			uint16_t part   = range->count - offset;
+			
+			if(part > left)
+				part = left;
+			
+			if(pass == 0)
+			{
+				if(range->validate)
+					error = range->validate(address, part, data);
+			}
+			else
+			{
+				nyamodbus_regmap_publish(range, offset, part, data);
+				
+				if(range->flags & REGMAP_CACHED)
+					nyamodbus_regmap_invalidate(map);
+				
+				if(range->on_write)
+					range->on_write(address, part);
+			}
+			
+			data    += part;
+			address += part;
+			left    -= part;
+		}
+	}
+	
+	return error;
+}
@@ -0,0 +1,161 @@
+//
+// Nyamodbus library register map v1.1.0
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _NYAMODBUS_REGMAP_H
+#define _NYAMODBUS_REGMAP_H
+
+#include "nyamodbus.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	// Register range access flags
+	typedef enum {
+		REGMAP_READ       = 0x01, // Range can be readed
+		REGMAP_WRITE      = 0x02, // Range can be written
+		REGMAP_READWRITE  = 0x03,
+		REGMAP_CACHED     = 0x04  // Responses can be cached until generation of map is changed (on_read is not called then; not allowed with lock)
+	} enum_nyamodbus_regmap_flags;
+
+	// Sequence lock for registers updated by other thread
+	// (writers are serialized, e.g. producer thread and FC06/FC16 for REGMAP_WRITE range;
+	//  readers retry if writer was active, so readers and writers must not be called from interrupt
+	//  that can preempt writer of the same lock)
+	typedef struct {
+		// Odd value - writer is active
+		uint32_t            sequence;
+	} str_nyamodbus_seqlock;
+
+	// Range access hook
+	//  start: index of first accessed register
+	//  count: accessed register count
+	typedef void (*nyamb_regmap_hook)(uint16_t start, uint16_t count);
+
+	// Range write validation
+	//  start: index of first written register
+	//  count: written register count
+	// values: new values [count]
+	// return: error code (ERROR_OK - write is allowed)
+	typedef enum_nyamodbus_error (*nyamb_regmap_validate)(uint16_t start, uint16_t count, const uint16_t * values);
+
+	// Register range
+	typedef struct {
+		// Index of first register
+		uint16_t            start;
+		
+		// Register count
+		uint16_t            count;
+		
+		// Register values [count]
+		uint16_t *          data;
+		
+		// Access flags (enum_nyamodbus_regmap_flags)
+		uint8_t             flags;
+		
+		// Called before registers are readed (optional, can update data)
+		nyamb_regmap_hook   on_read;
+		
+		// Called after registers are written (optional)
+		nyamb_regmap_hook   on_write;
+		
+		// Called before any register of request is written (optional)
+		nyamb_regmap_validate validate;
+		
+		// Sequence lock (optional): range is readed in one consistent pass, producers use nyamodbus_regmap_publish
+		str_nyamodbus_seqlock * lock;
+	} str_nyamodbus_regmap_range;
+
+	// Register map
+	typedef struct {
+		// Ranges sorted by start index, must not overlap
+		const str_nyamodbus_regmap_range * ranges;
+		
+		// Range count
+		uint16_t                           count;
+		
+		// Generation of map data (optional, changed on write; if not set, only read-only ranges are cached)
+		uint32_t *                         generation;
+	} str_nyamodbus_regmap;
+
+	// Check register map (ranges are sorted and not overlapped, locked ranges are not cached, cached writable ranges need generation)
+	//    map: register map
+	// return: true, if map is valid
+	bool nyamodbus_regmap_check(const str_nyamodbus_regmap * map);
+
+	// Find range with register
+	//     map: register map
+	// address: register index
+	//  return: range or 0, if register is not mapped
+	const str_nyamodbus_regmap_range * nyamodbus_regmap_find(const str_nyamodbus_regmap * map, uint16_t address);
+
+	// Read registers (request can span adjacent ranges)
+	//    map: register map
+	//  start: index of first register
+	//  count: register count
+	// values: registers [count]
+	// return: error code
+	enum_nyamodbus_error nyamodbus_regmap_read(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count, uint16_t * values);
+
+	// Write registers (request can span adjacent ranges, nothing is written on error)
+	//    map: register map
+	//  start: index of first register
+	//  count: register count
+	// values: registers [count]
+	// return: error code
+	enum_nyamodbus_error nyamodbus_regmap_write(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count, const uint16_t * values);
+
+	// Is registers can be cached (all ranges are readable, have REGMAP_CACHED flag and no lock, writable ranges need generation)
+	//    map: register map
+	//  start: index of first register
+	//  count: register count
+	// return: true, if response can be cached
+	bool nyamodbus_regmap_is_cached(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count);
+
+	// Check read access to registers (registers are not readed)
+	//    map: register map
+	//  start: index of first register
+	//  count: register count
+	// return: error code
+	enum_nyamodbus_error nyamodbus_regmap_check_read(const str_nyamodbus_regmap * map, uint16_t start, uint16_t count);
+
+	// Get generation of map data
+	//    map: register map
+	// return: generation
+	uint32_t nyamodbus_regmap_generation(const str_nyamodbus_regmap * map);
+
+	// Data of map was changed: cached responses are invalid (can be called from any thread)
+	// map: register map
+	void nyamodbus_regmap_invalidate(const str_nyamodbus_regmap * map);
+
+	// Start update of locked registers (writer, waits if other writer is active)
+	// lock: sequence lock
+	void nyamodbus_seqlock_write_begin(str_nyamodbus_seqlock * lock);
+
+	// Finish update of locked registers (writer)
+	// lock: sequence lock
+	void nyamodbus_seqlock_write_end(str_nyamodbus_seqlock * lock);
+
+	// Publish registers of range without blocking readers (producer thread)
+	//  range: register range
+	// offset: offset of first register in range
+	//  count: register count
+	// values: registers [count]
+	void nyamodbus_regmap_publish(const str_nyamodbus_regmap_range * range, uint16_t offset, uint16_t count, const uint16_t * values);
+
+	// Copy registers of range in one consistent pass (any thread)
+	//  range: register range
+	// offset: offset of first register in range
+	//  count: register count
+	// values: registers [count]
+	void nyamodbus_regmap_snapshot(const str_nyamodbus_regmap_range * range, uint16_t offset, uint16_t count, uint16_t * values);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif
@@ -4,18 +4,44 @@
 
 #include "nyamodbus_slave.h"
 #include "nyamodbus_utils.h"
+#include "nyamodbus_codec.h"
 #include <string.h>
 #include <stdio.h>
 
+// Deferred request status is shared with completing thread
+#if defined(__GNUC__)
+	#define SLAVE_STATUS_LOAD(ptr)         __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+	#define SLAVE_STATUS_STORE(ptr, v)     __atomic_store_n(ptr, v, __ATOMIC_RELEASE)
+	#define SLAVE_STATUS_CAS(ptr, old, v)  __atomic_compare_exchange_n(ptr, &(old), v, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#else
+	// Single core: completion must not be called from interrupt
+	#define SLAVE_STATUS_LOAD(ptr)         (*(volatile uint8_t *)(ptr))
+	#define SLAVE_STATUS_STORE(ptr, v)     (*(volatile uint8_t *)(ptr) = (v))
+	#define SLAVE_STATUS_CAS(ptr, old, v)  ((*(volatile uint8_t *)(ptr) == (old)) ? ((*(volatile uint8_t *)(ptr) = (v)), true) : false)
+#endif
+
 static void nyamodbus_slave_on_valid_packet(void * context, const uint8_t * data, uint16_t size);
 static void nyamodbus_slave_on_invalid_packet(void * context);
 static void nyamodbus_slave_on_data(void * context);
+static void nyamodbus_slave_host_on_valid_packet(void * context, const uint8_t * data, uint16_t size);
+static void nyamodbus_slave_host_on_data(void * context);
+static bool nyamodbus_slave_accept_address(void * context, uint8_t address);
+static bool nyamodbus_slave_host_accept_address(void * context, uint8_t address);
 
 const str_nyamodbus_driver slave_driver = {
 	.on_data            = nyamodbus_slave_on_data,
 	.on_valid_packet    = nyamodbus_slave_on_valid_packet,
 	.on_invalid_packet  = nyamodbus_slave_on_invalid_packet,
-	.on_timeout         = 0
+	.on_timeout         = 0,
+	.accept_address     = nyamodbus_slave_accept_address
+};
+
+const str_nyamodbus_driver slave_host_driver = {
+	.on_data            = nyamodbus_slave_host_on_data,
+	.on_valid_packet    = nyamodbus_slave_host_on_valid_packet,
+	.on_invalid_packet  = nyamodbus_slave_on_invalid_packet,
+	.on_timeout         = 0,
+	.accept_address     = nyamodbus_slave_host_accept_address
 };
 
 // Send error packet
@@ -30,128 +56,651 @@ static void nyamodbus_slave_send_error(const str_nyamodbus_slave_device * device
 	buffer[1] = function | 0x80;
 	buffer[2] = (uint8_t)error;
 	
+	nyamodbus_stats_count(device->device, STAT_EXCEPTIONS);
+	if(error == ERROR_NEED_DIAGNOSTIC)
+		nyamodbus_stats_count(device->device, STAT_NAKS);
+	else if(error == ERROR_BUSY)
+		nyamodbus_stats_count(device->device, STAT_BUSY);
+	
 	nyamodbus_send_packet(device->device, buffer, 3);
 }
 
 // Read digital values
-//   device: device context
-// function: function code
-//  address: start address
-//    count: register count
-//  readfunc: function to read data
-static enum_nyamodbus_error nyamodbus_slave_readdigital(const str_nyamodbus_slave_device * device, uint8_t function, uint16_t address, uint16_t count, nyamb_readdigital readfunc)
+//    device: device context
+//  function: function code
+//   address: start address
+//     count: register count
+//      bank: bit bank (used if set)
+//  readfunc: function to read single value
+// rangefunc: function to read block of values (used if set)
+static enum_nyamodbus_error nyamodbus_slave_readdigital(const str_nyamodbus_slave_device * device, uint8_t function, uint16_t address, uint16_t count, const str_nyamodbus_bitbank * bank, nyamb_readdigital readfunc, nyamb_readdigital_range rangefunc)
 {
 	enum_nyamodbus_error error = ERROR_NO_FUNCTION;
 	uint8_t result[NYAMODBUS_OUTPUT_BUFFER_SIZE];
 	uint16_t i;
-	uint8_t bytes = (count + 7) / 8;
+	uint16_t bytes;
 	uint8_t value = 0;
 	
+	// Count is checked before size arithmetic
+	if(count > NYAMODBUS_MAX_READ_BITS)
+		return ERROR_INV_REQ_VALUE;
+	
+	bytes = (count + 7) / 8;
+	if(bytes + 5 > NYAMODBUS_OUTPUT_BUFFER_SIZE)
+		return ERROR_INV_REQ_VALUE;
+	
 	result[0] = *device->address; // slave address
 	result[1] = function;                 // function code
 	result[2] = bytes;                    // bytes after header
 	
-	bytes = 3;
-	for(i = 0; i < count; i++)
+	if(bank || rangefunc)
 	{
-		uint8_t bit = i & 0x7;
-		uint16_t reg = address + i;
+		memset(&result[3], 0, bytes);
+		error = bank ? nyamodbus_bitbank_read(bank, address, count, &result[3]) : rangefunc(address, count, &result[3]);
 		
-		bool contact = false;
-		error = readfunc(reg, &contact);
+		// Unused bits of last byte must be zero
+		if(count & 0x07)
+			result[2 + bytes] &= (1 << (count & 0x07)) - 1;
 		
+		bytes += 3;
+	}
+	else
+	{
+		bytes = 3;
+		for(i = 0; i < count; i++)
+		{
+			uint8_t bit = i & 0x7;
+			uint16_t reg = address + i;
+			
+			bool contact = false;
+			error = readfunc(reg, &contact);
+			
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-		printf("    REG: %04x = %d\n", reg, contact ? 1 : 0);
+			printf("    REG: %04x = %d\n", reg, contact ? 1 : 0);
 #endif
-		if(error != ERROR_OK)
-			break;
-		
-		if(contact)
-			value |= (1 << bit);
+			if(error != ERROR_OK)
+				break;
+			
+			if(contact)
+				value |= (1 << bit);
+			
+			if((i & 0x07) == 0x07)
+			{
+				result[bytes++] = value;
+				value = 0;
+			}
+		}
 		
-		if((i & 0x07) == 0x07)
+		if((i & 0x07) != 0x00)
 		{
 			result[bytes++] = value;
-			value = 0;
 		}
 	}
 	
-	if((i & 0x07) != 0x00)
-	{
-		result[bytes++] = value;
-	}
-	
 	if(error == ERROR_OK)
 		nyamodbus_send_packet(device->device, result, bytes);
 	
 	return error;
 }
 
+// Is holding registers can be readed
+// device: device context
+// return: true, if any handler or map is set
+static bool nyamodbus_slave_has_readholding(const str_nyamodbus_slave_device * device)
+{
+	return device->holdingmap || device->readholding_range || device->readholding;
+}
+
+// Is holding registers can be written
+// device: device context
+// return: true, if any handler or map is set
+static bool nyamodbus_slave_has_writeholding(const str_nyamodbus_slave_device * device)
+{
+	return device->holdingmap || device->writeholding_range || device->writeholding;
+}
+
+// Read analog registers
+//       map: register map (used if set)
+//  readfunc: function to read single register
+// rangefunc: function to read block of registers (used if set)
+//   address: start address
+//     count: register count
+//    values: registers [count]
+static enum_nyamodbus_error nyamodbus_slave_readregs(const str_nyamodbus_regmap * map, nyamb_readanalog readfunc, nyamb_readanalog_range rangefunc, uint16_t address, uint16_t count, uint16_t * values)
+{
+	enum_nyamodbus_error error = ERROR_NO_FUNCTION;
+	uint16_t i;
+	
+	if(map)
+		return nyamodbus_regmap_read(map, address, count, values);
+	
+	if(rangefunc)
+		return rangefunc(address, count, values);
+	
+	for(i = 0; i < count; i++)
+	{
+		uint16_t reg = address + i;
+		
+		values[i] = 0;
+		error = readfunc(reg, &values[i]);
+		
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+		printf("    REG: %04x = %d\n", reg, values[i]);
+#endif
+		if(error != ERROR_OK)
+			break;
+	}
+	
+	return error;
+}
+
+// Check read access to holding registers (FC23 read must not fail after write)
+//  device: device context
+// address: start address
+//   count: register count, checked by caller
+static enum_nyamodbus_error nyamodbus_slave_checkreadholding(const str_nyamodbus_slave_device * device, uint16_t address, uint16_t count)
+{
+	uint16_t values[NYAMODBUS_MAX_REGISTERS];
+	
+	if(device->holdingmap)
+		return nyamodbus_regmap_check_read(device->holdingmap, address, count);
+	
+	// Handlers have no access check: registers are readed
+	return nyamodbus_slave_readregs(0, device->readholding, device->readholding_range, address, count, values);
+}
+
+// Find cached response
+//     device: device context
+//   function: function code
+//    address: start address
+//      count: register count
+// generation: generation of register map
+//     return: entry or 0
+static const str_nyamodbus_slave_cache_entry * nyamodbus_slave_cache_find(const str_nyamodbus_slave_device * device, uint8_t function, uint16_t address, uint16_t count, uint32_t generation)
+{
+	uint8_t i;
+	
+	for(i = 0; i < NYAMODBUS_RESPONSE_CACHE_SIZE; i++)
+	{
+		const str_nyamodbus_slave_cache_entry * entry = &device->cache->entries[i];
+		
+		if((entry->size > 0) && (entry->function == function) && (entry->start == address) && (entry->count == count) &&
+		   (entry->generation == generation) && (entry->frame[0] == *device->address))
+			return entry;
+	}
+	
+	return 0;
+}
+
+// Store response to cache
+//     device: device context
+//   function: function code
+//    address: start address
+//      count: register count
+// generation: generation of register map
+//       data: response without crc
+//       size: response size
+//     return: stored entry
+static const str_nyamodbus_slave_cache_entry * nyamodbus_slave_cache_store(const str_nyamodbus_slave_device * device, uint8_t function, uint16_t address, uint16_t count, uint32_t generation, const uint8_t * data, uint8_t size)
+{
+	str_nyamodbus_slave_cache * cache = device->cache;
+	str_nyamodbus_slave_cache_entry * entry = &cache->entries[cache->next];
+	
+	cache->next = (cache->next + 1) % NYAMODBUS_RESPONSE_CACHE_SIZE;
+	
+	entry->function   = function;
+	entry->start      = address;
+	entry->count      = count;
+	entry->generation = generation;
+	entry->size       = nyamodbus_make_frame(entry->frame, data, size);
+	return entry;
+}
+
 // Read analog values
-//   device: device context
-// function: function code
-//  address: start address
-//    count: register count
-//  readfunc: function to read data
-static enum_nyamodbus_error nyamodbus_slave_readanalog(const str_nyamodbus_slave_device * device, uint8_t function, uint16_t address, uint16_t count, nyamb_readanalog readfunc)
+//    device: device context
+//  function: function code
+//   address: start address
+//     count: register count
+//       map: register map (used if set)
+//  readfunc: function to read single register
+// rangefunc: function to read block of registers (used if set)
+static enum_nyamodbus_error nyamodbus_slave_readanalog(const str_nyamodbus_slave_device * device, uint8_t function, uint16_t address, uint16_t count, const str_nyamodbus_regmap * map, nyamb_readanalog readfunc, nyamb_readanalog_range rangefunc)
 {
 	enum_nyamodbus_error error = ERROR_NO_FUNCTION;
 	uint8_t result[NYAMODBUS_OUTPUT_BUFFER_SIZE];
-	uint16_t i;
-	uint8_t bytes = count * 2;
+	uint16_t values[NYAMODBUS_MAX_REGISTERS];
+	uint16_t bytes = count * 2;
 
-	if((count == 0) || (bytes + 5 < NYAMODBUS_OUTPUT_BUFFER_SIZE))
+	// Count is checked first: count * 2 wraps for count >= 0x8000
+	if((count <= NYAMODBUS_MAX_READ_REGISTERS) && (count <= NYAMODBUS_MAX_REGISTERS) && (bytes + 5 < NYAMODBUS_OUTPUT_BUFFER_SIZE))
 	{
+		bool     cached     = device->cache && map && nyamodbus_regmap_is_cached(map, address, count);
+		uint32_t generation = cached ? nyamodbus_regmap_generation(map) : 0;
+		
+		if(cached)
+		{
+			const str_nyamodbus_slave_cache_entry * entry = nyamodbus_slave_cache_find(device, function, address, count, generation);
+			if(entry)
+			{
+				nyamodbus_send_frame(device->device, entry->frame, entry->size);
+				return ERROR_OK;
+			}
+		}
+		
 		result[0] = *device->address; // slave address
 		result[1] = function;                 // function code
 		result[2] = bytes;                    // bytes after header
 		
-		bytes = 3;
-		for(i = 0; i < count; i++)
+		error = nyamodbus_slave_readregs(map, readfunc, rangefunc, address, count, values);
+		if(error == ERROR_OK)
 		{
-			uint16_t reg = address + i;
-			
-			uint16_t value = 0;
-			error = readfunc(reg, &value);
+			nyamodbus_encode_u16(&result[3], values, count);
 			
+			if(cached)
+			{
+				const str_nyamodbus_slave_cache_entry * entry = nyamodbus_slave_cache_store(device, function, address, count, generation, result, 3 + bytes);
+				nyamodbus_send_frame(device->device, entry->frame, entry->size);
+			}
+			else
+				nyamodbus_send_packet(device->device, result, 3 + bytes);
+		}
+		
+		return error;
+	}
+	else
+		return ERROR_INV_REQ_VALUE;
+}
+
+// Write holding registers
+//  device: device context
+// address: start address
+//   count: register count
+//  values: registers [count]
+static enum_nyamodbus_error nyamodbus_slave_commitregs(const str_nyamodbus_slave_device * device, uint16_t address, uint16_t count, const uint16_t * values)
+{
+	enum_nyamodbus_error error = ERROR_OK;
+	uint16_t i;
+	
+	if(device->holdingmap)
+		return nyamodbus_regmap_write(device->holdingmap, address, count, values);
+	
+	if(device->writeholding_range)
+		return device->writeholding_range(address, count, values);
+	
+	for(i = 0; i < count; i++)
+	{
+		uint16_t reg = address + i;
+		
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-			printf("    REG: %04x = %d\n", reg, value);
+		printf("    REG %04x = %04x\n", reg, values[i]);
 #endif
-			if(error != ERROR_OK)
+		error = device->writeholding(reg, values[i]);
+		if(error != ERROR_OK)
+			break;
+	}
+	
+	return error;
+}
+
+// Validate and write holding registers
+//  device: device context
+// address: start address
+//   count: register count
+//  values: registers [count]
+static enum_nyamodbus_error nyamodbus_slave_writeregs(const str_nyamodbus_slave_device * device, uint16_t address, uint16_t count, const uint16_t * values)
+{
+	enum_nyamodbus_error error = ERROR_OK;
+	
+	if(device->validateholding)
+		error = device->validateholding(address, count, values);
+	
+	if(error == ERROR_OK)
+		error = nyamodbus_slave_commitregs(device, address, count, values);
+	
+	if((error == ERROR_OK) && device->holdingchanged)
+		device->holdingchanged(address, count);
+	
+	return error;
+}
+
+// Write holding registers
+//  device: device context
+// address: start address
+//   count: register count
+//    data: register values from packet [count * 2]
+static enum_nyamodbus_error nyamodbus_slave_writeholdings(const str_nyamodbus_slave_device * device, uint16_t address, uint16_t count, const uint8_t * data)
+{
+	uint16_t values[NYAMODBUS_MAX_REGISTERS];
+	
+	if(count > NYAMODBUS_MAX_REGISTERS)
+		return ERROR_INV_REQ_VALUE;
+	
+	nyamodbus_decode_u16(values, data, count);
+	return nyamodbus_slave_writeregs(device, address, count, values);
+}
+
+// Write coils
+//  device: device context
+// address: start address
+//   count: coil count
+//    bits: packed values from packet [(count + 7) / 8]
+static enum_nyamodbus_error nyamodbus_slave_commitcoils(const str_nyamodbus_slave_device * device, uint16_t address, uint16_t count, const uint8_t * bits)
+{
+	enum_nyamodbus_error error = ERROR_OK;
+	uint16_t i;
+	
+	if(device->coilbank)
+		return nyamodbus_bitbank_write(device->coilbank, address, count, bits);
+	
+	if(device->writecoil_range)
+		return device->writecoil_range(address, count, bits);
+	
+	for(i = 0; i < count; i++)
+	{
+		uint16_t reg  = address + i;
+		bool value = nyamodbus_bits_get(bits, i);
+		
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+		printf("    REG %04x = %d\n", reg, value ? 1 : 0);
+#endif
+		error = device->writecoil(reg, value);
+		if(error != ERROR_OK)
+			break;
+	}
+	
+	return error;
+}
+
+// Validate and write coils
+//  device: device context
+// address: start address
+//   count: coil count
+//    bits: packed values from packet [(count + 7) / 8]
+static enum_nyamodbus_error nyamodbus_slave_writecoils(const str_nyamodbus_slave_device * device, uint16_t address, uint16_t count, const uint8_t * bits)
+{
+	enum_nyamodbus_error error = ERROR_OK;
+	
+	if(device->validatecoils)
+		error = device->validatecoils(address, count, bits);
+	
+	if(error == ERROR_OK)
+		error = nyamodbus_slave_commitcoils(device, address, count, bits);
+	
+	if((error == ERROR_OK) && device->coilschanged)
+		device->coilschanged(address, count);
+	
+	return error;
+}
+
+// Encode device information objects
+//   device: device context
+// identity: cache to fill
+static void nyamodbus_slave_identity_encode(const str_nyamodbus_slave_device * device, str_nyamodbus_slave_identity * identity)
+{
+	uint16_t obj;
+	
+	identity->size = 0;
+	identity->last = 0;
+	
+	for(obj = 0; obj < 256; obj++)
+	{
+		const char * value = device->readdeviceinfo(obj);
+		uint16_t     free  = sizeof(identity->data) - identity->size;
+		size_t       length;
+		
+		if(value == 0)
+			continue;
+		
+		if(free < 3)
+			break;
+		
+		// Object is truncated if cache is full
+		length = strlen(value);
+		if(length > free - 2)
+			length = free - 2;
+		if(length > 0xFF)
+			length = 0xFF;
+		
+		identity->data[identity->size++] = (uint8_t)obj;
+		identity->data[identity->size++] = (uint8_t)length;
+		memcpy(&identity->data[identity->size], value, length);
+		identity->size += length;
+		identity->last  = (uint8_t)obj;
+	}
+	
+	identity->valid = true;
+}
+
+// Find next device information object
+//   device: device context
+// identity: device information cache (0 - objects are readed by readdeviceinfo)
+//     last: last object id of requested category
+//       id: first object id to check, id of found object
+//    value: object value
+//   length: object length
+//   return: true, if object is found
+static bool nyamodbus_slave_identity_next(const str_nyamodbus_slave_device * device, const str_nyamodbus_slave_identity * identity, uint8_t last, uint16_t * id, const uint8_t ** value, uint8_t * length)
+{
+	if(identity)
+	{
+		uint16_t offset = 0;
+		
+		// Objects are sorted by id
+		while((offset < identity->size) && (identity->data[offset] < *id))
+			offset += 2 + identity->data[offset + 1];
+		
+		if((offset >= identity->size) || (identity->data[offset] > last))
+			return false;
+		
+		*id     = identity->data[offset];
+		*length = identity->data[offset + 1];
+		*value  = &identity->data[offset + 2];
+		return true;
+	}
+	
+	// No cache: only objects of requested range are readed
+	for(; *id <= last; (*id)++)
+	{
+		const char * object = device->readdeviceinfo((uint8_t)*id);
+		
+		if(object)
+		{
+			size_t size = strlen(object);
+			
+			*length = (size > 0xFF) ? 0xFF : (uint8_t)size;
+			*value  = (const uint8_t *)object;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+// Read device identification (FC43 / MEI 0x0E)
+//   device: device context
+// identity: device information cache (0 - objects are readed by readdeviceinfo)
+//  devcode: read device id code (1 - basic, 2 - regular, 3 - extended stream, 4 - one object)
+//   object: first object id
+//   return: error code
+static enum_nyamodbus_error nyamodbus_slave_identification(const str_nyamodbus_slave_device * device, const str_nyamodbus_slave_identity * identity, uint8_t devcode, uint8_t object)
+{
+	uint8_t  result[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+	uint16_t bytes = 8;
+	uint16_t limit = NYAMODBUS_OUTPUT_BUFFER_SIZE - 2; // crc
+	uint16_t id    = object;
+	uint8_t  highest;
+	const uint8_t * value;
+	uint8_t  length;
+	uint8_t  last;
+	uint8_t  count = 0;
+	
+	switch(devcode)
+	{
+		case 1: last = 0x02; break;
+		case 2: last = 0x7F; break;
+		case 3: last = 0xFF; break;
+		case 4: last = object; break;
+		default:
+			return ERROR_INV_REQ_VALUE;
+	}
+	
+	if((object > last) || !nyamodbus_slave_identity_next(device, identity, object, &id, &value, &length))
+	{
+		// Individual access: object must exist, stream: restart from first object
+		if(devcode == 4)
+			return ERROR_NO_DATAADDRESS;
+		
+		id = 0;
+	}
+	
+	// Conformity level: by all objects if cache is set, else by requested category
+	highest = identity ? identity->last : last;
+	
+	result[0] = *device->address;             // slave address
+	result[1] = FUNCTION_READ_DEVICE_IDENTIFICATION;
+	result[2] = 0x0E;                         // MEI type
+	result[3] = devcode;
+	result[4] = 0x80 | ((highest > 0x7F) ? 3 : ((highest > 0x02) ? 2 : 1)); // conformity level, individual access is supported
+	result[5] = 0x00;                         // more follows
+	result[6] = 0x00;                         // next object id
+	
+	while(nyamodbus_slave_identity_next(device, identity, last, &id, &value, &length))
+	{
+		if(bytes + 2 + length > limit)
+		{
+			if(count > 0)
+			{
+				// Rest of objects will be requested by master
+				result[5] = 0xFF;
+				result[6] = (uint8_t)id;
 				break;
+			}
 			
-			result[bytes++] = (value >> 8) & 0xFF;
-			result[bytes++] = value & 0xFF;
+			// Single object is too long for packet: truncate
+			length = limit - bytes - 2;
 		}
 		
-		if(error == ERROR_OK)
-			nyamodbus_send_packet(device->device, result, bytes);
+		result[bytes++] = (uint8_t)id;
+		result[bytes++] = length;
+		memcpy(&result[bytes], value, length);
+		bytes += length;
+		count++;
 		
-		return error;
+		if((devcode == 4) || (bytes >= limit))
+			break;
+		
+		id++;
 	}
-	else
-		return ERROR_INV_REQ_VALUE;
+	
+	result[7] = count;
+	nyamodbus_send_packet(device->device, result, bytes);
+	return ERROR_OK;
 }
 
-// Read device information
-//      id: object id
-//   value: buffer
-//    size: buffer size / result size 	
+// Device information was changed, it will be encoded again on next request
+// device: device context
+void nyamodbus_slave_identity_invalidate(const str_nyamodbus_slave_device * device)
+{
+	if(device->identity)
+		device->identity->valid = false;
+}
+
+// Read file records (FC20)
+//  device: device context
+// request: subrequests: REF FH FL RH RL CH CL
+//   bytes: subrequests size
 //  return: error code
-static enum_nyamodbus_error nyamodbus_slave_readdeviceinfo(const char * id, uint8_t * value, uint8_t * size)
+static enum_nyamodbus_error nyamodbus_slave_readfiles(const str_nyamodbus_slave_device * device, const uint8_t * request, uint8_t bytes)
 {
-	if(id != 0)
+	uint8_t  result[NYAMODBUS_FILE_MAX_PACKET];
+	uint16_t length = 3;
+	uint16_t i;
+	
+	for(i = 0; i < bytes; i += 7)
 	{
-		uint8_t tocopy = strlen(id);
-		if(tocopy > *size)
-			tocopy = *size;
+		const uint8_t * sub = &request[i];
+		uint16_t number = get_u16_value(sub, 1);
+		uint16_t record = get_u16_value(sub, 3);
+		uint16_t count  = get_u16_value(sub, 5);
+		const str_nyamodbus_file * file = nyamodbus_file_find(device->files, device->file_count, number);
+		enum_nyamodbus_error error;
 		
-		strncpy((char*)value, id, tocopy);
-		*size = tocopy;
-		return ERROR_OK;
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+		printf("   READ_FILE: file %04x record %04x count %d\n", number, record, count);
+#endif
+		if((sub[0] != NYAMODBUS_FILE_REFERENCE) || (length + 2 + (uint32_t)count * 2 > sizeof(result)) || (length + 2 + (uint32_t)count * 2 > 3 + 0xF5))
+			return ERROR_INV_REQ_VALUE;
+		
+		error = nyamodbus_file_check(file, record, count, FILE_READ);
+		if(error != ERROR_OK)
+			return error;
+		
+		// LEN REF DATA
+		result[length]     = 1 + count * 2;
+		result[length + 1] = NYAMODBUS_FILE_REFERENCE;
+		memcpy(&result[length + 2], &file->data[record * 2], count * 2);
+		length += 2 + count * 2;
 	}
-	else
-		return ERROR_NO_DATAADDRESS;
+	
+	result[0] = *device->address;
+	result[1] = FUNCTION_READ_FILE_RECORD;
+	result[2] = length - 3;
+	
+	nyamodbus_send_packet(device->device, result, length);
+	return ERROR_OK;
+}
+
+// Write file records (FC21), all subrequests are checked before write
+//  device: device context
+// request: subrequests: REF FH FL RH RL CH CL DATA
+//   bytes: subrequests size
+//  return: error code
+static enum_nyamodbus_error nyamodbus_slave_writefiles(const str_nyamodbus_slave_device * device, const uint8_t * request, uint8_t bytes)
+{
+	uint16_t offset;
+	
+	for(offset = 0; offset < bytes; )
+	{
+		const uint8_t * sub = &request[offset];
+		uint16_t record;
+		uint16_t count;
+		enum_nyamodbus_error error;
+		
+		if((offset + 7 > bytes) || (sub[0] != NYAMODBUS_FILE_REFERENCE))
+			return ERROR_INV_REQ_VALUE;
+		
+		record = get_u16_value(sub, 3);
+		count  = get_u16_value(sub, 5);
+		if(offset + 7 + (uint32_t)count * 2 > bytes)
+			return ERROR_INV_REQ_VALUE;
+		
+		error = nyamodbus_file_check(nyamodbus_file_find(device->files, device->file_count, get_u16_value(sub, 1)), record, count, FILE_WRITE);
+		if(error != ERROR_OK)
+			return error;
+		
+		offset += 7 + count * 2;
+	}
+	
+	for(offset = 0; offset < bytes; )
+	{
+		const uint8_t * sub = &request[offset];
+		uint16_t number = get_u16_value(sub, 1);
+		uint16_t record = get_u16_value(sub, 3);
+		uint16_t count  = get_u16_value(sub, 5);
+		const str_nyamodbus_file * file = nyamodbus_file_find(device->files, device->file_count, number);
+		
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+		printf("   WRITE_FILE: file %04x record %04x count %d\n", number, record, count);
+#endif
+		memcpy(&file->data[record * 2], &sub[7], count * 2);
+		
+		if(file->on_write)
+			file->on_write(number, record, count);
+		
+		offset += 7 + count * 2;
+	}
+	
+	return ERROR_OK;
 }
 
 // Process packet
@@ -176,9 +725,13 @@ static enum_nyamodbus_error nyamodbus_slave_process(const str_nyamodbus_slave_de
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
 			printf("   READ_COIL: %04x-%04x (%d)\n", address, address + count - 1, count);
 #endif
-			if(device->readcoils)
+			if(size < 8)
+			{
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->coilbank || device->readcoils || device->readcoils_range)
 			{
-				error = nyamodbus_slave_readdigital(device, FUNCTION_READ_COIL, address, count, device->readcoils);
+				error = nyamodbus_slave_readdigital(device, FUNCTION_READ_COIL, address, count, device->coilbank, device->readcoils, device->readcoils_range);
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
@@ -195,9 +748,13 @@ static enum_nyamodbus_error nyamodbus_slave_process(const str_nyamodbus_slave_de
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
 			printf("   READ_CONTACTS: %04x-%04x (%d)\n", address, address + count - 1, count);
 #endif
-			if(device->readcontacts)
+			if(size < 8)
 			{
-				error = nyamodbus_slave_readdigital(device, FUNCTION_READ_CONTACTS, address, count, device->readcontacts);
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->contactbank || device->readcontacts || device->readcontacts_range)
+			{
+				error = nyamodbus_slave_readdigital(device, FUNCTION_READ_CONTACTS, address, count, device->contactbank, device->readcontacts, device->readcontacts_range);
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
@@ -214,9 +771,13 @@ static enum_nyamodbus_error nyamodbus_slave_process(const str_nyamodbus_slave_de
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
 			printf("   READ_HOLDING: %04x-%04x (%d)\n", address, address + count - 1, count);
 #endif
-			if(device->readholding)
+			if(size < 8)
 			{
-				error = nyamodbus_slave_readanalog(device, FUNCTION_READ_HOLDING, address, count, device->readholding);
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(nyamodbus_slave_has_readholding(device))
+			{
+				error = nyamodbus_slave_readanalog(device, FUNCTION_READ_HOLDING, address, count, device->holdingmap, device->readholding, device->readholding_range);
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
@@ -233,9 +794,13 @@ static enum_nyamodbus_error nyamodbus_slave_process(const str_nyamodbus_slave_de
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
 			printf("   READ_INPUTS: %04x-%04x (%d)\n", address, address + count - 1, count);
 #endif
-			if(device->readanalog)
+			if(size < 8)
+			{
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->inputmap || device->readanalog || device->readanalog_range)
 			{
-				error = nyamodbus_slave_readanalog(device, FUNCTION_READ_INPUTS, address, count, device->readanalog);
+				error = nyamodbus_slave_readanalog(device, FUNCTION_READ_INPUTS, address, count, device->inputmap, device->readanalog, device->readanalog_range);
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
@@ -253,209 +818,421 @@ static enum_nyamodbus_error nyamodbus_slave_process(const str_nyamodbus_slave_de
 			printf("   WRITE_COIL: %04x = %04x\n", address, value);
 #endif
 
-			if(device->writecoil)
+			if(size < 8)
 			{
-				error = device->writecoil(address, (value & 0x01) != 0);
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if((value != 0xFF00) && (value != 0x0000))
+			{
+				// 0xFF00 - ON, 0x0000 - OFF
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->coilbank || device->writecoil || device->writecoil_range)
+			{
+				uint8_t bits = (value == 0xFF00) ? 1 : 0;
 				
-				if(error == ERROR_OK)
+				error = nyamodbus_slave_writecoils(device, address, 1, &bits);
+				
+				if((error == ERROR_OK) && !broadcast)
 					nyamodbus_send_packet(device->device, data, 6);
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
-			else
-				puts("    No handler: device->writecoil");
+			else
+				puts("    No handler: device->writecoil");
+#endif
+		}
+		break;
+		
+	case FUNCTION_WRITE_HOLDING_SINGLE:
+		// AH AL VH VL
+		{
+			uint16_t address = get_u16_value(data, 2);
+			uint16_t value   = get_u16_value(data, 4);
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("   WRITE_HOLDING: REG %04x = %04x\n", address, value);
+#endif
+			if(size < 8)
+			{
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(nyamodbus_slave_has_writeholding(device))
+			{
+				error = nyamodbus_slave_writeregs(device, address, 1, &value);
+				
+				if((error == ERROR_OK) && !broadcast)
+					nyamodbus_send_packet(device->device, data, 6);
+			}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			else
+				puts("    No handler: device->writeholding");
+#endif
+		}
+		break;
+		
+	case FUNCTION_READ_EXCEPTION_STATUS:
+		if(device->readexceptionstatus)
+		{
+			uint8_t result[3];
+			
+			result[0] = *device->address;
+			result[1] = FUNCTION_READ_EXCEPTION_STATUS;
+			result[2] = device->readexceptionstatus();
+			
+			nyamodbus_send_packet(device->device, result, 3);
+			error = ERROR_OK;
+		}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+		else
+			puts("    No handler: device->readexceptionstatus");
+#endif
+		break;
+		
+	case FUNCTION_DIAGNOSTIC:
+		// SH SL DH DL...
+		{
+			uint16_t subfunc = get_u16_value(data, 2);
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("   DIAGNOSTIC: subfunction %04x\n", subfunc);
+#endif
+			if((size < 8) || (size > NYAMODBUS_OUTPUT_BUFFER_SIZE))
+			{
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(subfunc == 0x00)
+			{
+				// Return query data: request is echoed
+				nyamodbus_send_packet(device->device, data, size - 2);
+				error = ERROR_OK;
+			}
+			else if(subfunc == 0x0A)
+			{
+				// Clear counters
+				nyamodbus_stats_clear(device->device);
+				nyamodbus_send_packet(device->device, data, 6);
+				error = ERROR_OK;
+			}
+			else if((subfunc >= 0x0B) && (subfunc < 0x0B + STAT_COUNT) && device->device->stats)
+			{
+				// Return counter
+				uint8_t result[6];
+				
+				memcpy(result, data, 4);
+				set_u16_value(result, 4, nyamodbus_stats_get(device->device, (enum_nyamodbus_stat)(subfunc - 0x0B)));
+				
+				nyamodbus_send_packet(device->device, result, 6);
+				error = ERROR_OK;
+			}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			else
+				puts("    Unsupported subfunction");
+#endif
+		}
+		break;
+		
+	case FUNCTION_WRITE_COIL_MULTI:
+		// AH AL CH CL SZ DATA
+		{
+			uint16_t address = get_u16_value(data, 2);
+			uint16_t count   = get_u16_value(data, 4);
+			uint8_t bytes    = data[6];
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("   WRITE_COIL_MULTI: %04x count %04x (%d bytes data)\n", address, count, bytes);
+#endif
+			if((count > 0) && (count <= NYAMODBUS_MAX_WRITE_BITS) && (bytes == (count + 7) / 8) && (size >= 9 + bytes))
+			{
+				if(device->coilbank || device->writecoil || device->writecoil_range)
+				{
+					error = nyamodbus_slave_writecoils(device, address, count, &data[7]);
+					if((error == ERROR_OK) && !broadcast)
+					{
+						uint8_t result[6];
+						result[0] = data[0]; // slave address
+						result[1] = func;    // function code
+						set_u16_value(result, 2, address);
+						set_u16_value(result, 4, count);
+						
+						nyamodbus_send_packet(device->device, result, 6);
+					}
+				}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				else
+					puts("    No handler: device->writecoil");
+#endif
+			}
+			else
+			{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				puts("    Invalid count/size");
+#endif
+				error = ERROR_INV_REQ_VALUE;
+			}
+		}
+		break;
+		
+	case FUNCTION_WRITE_HOLDING_MULTI:
+		// AH AL CH CL SZ DATA
+		{
+			uint16_t address = get_u16_value(data, 2);
+			uint16_t count   = get_u16_value(data, 4);
+			uint8_t bytes    = data[6];
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("   WRITE_HOLDING_MULTI: %04x count %04x  (%d bytes data)\n", address, count, bytes);
+#endif
+			if((size >= 9 + bytes) && (bytes == count * 2))
+			{
+				if(nyamodbus_slave_has_writeholding(device))
+				{
+					error = nyamodbus_slave_writeholdings(device, address, count, &data[7]);
+					if((error == ERROR_OK) && !broadcast)
+					{
+						uint8_t result[6];
+						result[0] = data[0]; // slave address
+						result[1] = func;    // function code
+						set_u16_value(result, 2, address);
+						set_u16_value(result, 4, count);
+						
+						nyamodbus_send_packet(device->device, result, 6);
+					}
+				}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				else
+					puts("    No handler: device->writeholding");
+#endif
+			}
+			else
+			{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				puts("    Invalid count/size");
+#endif
+				error = ERROR_INV_REQ_VALUE;
+			}
+		}
+		break;
+		
+	case FUNCTION_MASK_WRITE_HOLDING:
+		// AH AL ANDH ANDL ORH ORL
+		{
+			uint16_t address  = get_u16_value(data, 2);
+			uint16_t and_mask = get_u16_value(data, 4);
+			uint16_t or_mask  = get_u16_value(data, 6);
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("   MASK_WRITE_HOLDING: REG %04x and %04x or %04x\n", address, and_mask, or_mask);
+#endif
+			if(size < 10)
+			{
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->maskwriteholding)
+			{
+				error = device->maskwriteholding(address, and_mask, or_mask);
+			}
+			else if(nyamodbus_slave_has_readholding(device) && nyamodbus_slave_has_writeholding(device))
+			{
+				uint16_t value = 0;
+				
+				error = nyamodbus_slave_readregs(device->holdingmap, device->readholding, device->readholding_range, address, 1, &value);
+				if(error == ERROR_OK)
+				{
+					value = (value & and_mask) | (or_mask & ~and_mask);
+					error = nyamodbus_slave_writeregs(device, address, 1, &value);
+				}
+			}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			else
+				puts("    No handler: device->maskwriteholding");
+#endif
+			
+			if((error == ERROR_OK) && !broadcast)
+				nyamodbus_send_packet(device->device, data, 8);
+		}
+		break;
+		
+	case FUNCTION_READWRITE_HOLDING:
+		// RAH RAL RCH RCL WAH WAL WCH WCL SZ DATA
+		{
+			uint16_t read_address  = get_u16_value(data, 2);
+			uint16_t read_count    = get_u16_value(data, 4);
+			uint16_t write_address = get_u16_value(data, 6);
+			uint16_t write_count   = get_u16_value(data, 8);
+			uint8_t  bytes         = data[10];
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("   READWRITE_HOLDING: read %04x count %04x, write %04x count %04x (%d bytes data)\n", read_address, read_count, write_address, write_count, bytes);
+#endif
+			// Read count is validated before write: registers must not be changed by invalid request
+			if((read_count > 0) && (read_count <= NYAMODBUS_MAX_READ_REGISTERS) && (read_count <= NYAMODBUS_MAX_REGISTERS) && (read_count * 2 + 5 < NYAMODBUS_OUTPUT_BUFFER_SIZE) &&
+			   (write_count > 0) && (bytes == write_count * 2) && (size >= 13 + bytes))
+			{
+				if(nyamodbus_slave_has_readholding(device) && nyamodbus_slave_has_writeholding(device))
+				{
+					// Write is done before read, read access is checked first
+					error = nyamodbus_slave_checkreadholding(device, read_address, read_count);
+					if(error == ERROR_OK)
+						error = nyamodbus_slave_writeholdings(device, write_address, write_count, &data[11]);
+					if(error == ERROR_OK)
+						error = nyamodbus_slave_readanalog(device, FUNCTION_READWRITE_HOLDING, read_address, read_count, device->holdingmap, device->readholding, device->readholding_range);
+				}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				else
+					puts("    No handler: device->readholding or device->writeholding");
+#endif
+			}
+			else
+			{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				puts("    Invalid count/size");
 #endif
+				error = ERROR_INV_REQ_VALUE;
+			}
 		}
 		break;
 		
-	case FUNCTION_WRITE_HOLDING_SINGLE:
-		// AH AL VH VL
+	case FUNCTION_READ_FILE_RECORD:
+		// SZ [REF FH FL RH RL CH CL]...
 		{
-			uint16_t address = get_u16_value(data, 2);
-			uint16_t value   = get_u16_value(data, 4);
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-			printf("   WRITE_HOLDING: REG %04x = %04x\n", address, value);
+			uint8_t bytes = data[2];
+			
+			if((bytes < 7) || (bytes > 0xF5) || ((bytes % 7) != 0) || (size < 5 + bytes))
+			{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+				puts("    Invalid count/size");
 #endif
-			if(device->writeholding)
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->files)
 			{
-				error = device->writeholding(address, value);
-				
-				if(error == ERROR_OK)
-					nyamodbus_send_packet(device->device, data, 6);
+				error = nyamodbus_slave_readfiles(device, &data[3], bytes);
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
-				puts("    No handler: device->writeholding");
+				puts("    No handler: device->files");
 #endif
 		}
 		break;
 		
-	case FUNCTION_READ_EXCEPTION_STATUS:
-	
-		break;
-		
-	case FUNCTION_DIAGNOSTIC:
-		break;
-		
-	case FUNCTION_WRITE_COIL_MULTI:
-		// AH AL CH CL SZ DATA
+	case FUNCTION_WRITE_FILE_RECORD:
+		// SZ [REF FH FL RH RL CH CL DATA]...
 		{
-			uint16_t address = get_u16_value(data, 2);
-			uint16_t count   = get_u16_value(data, 4);
-			uint8_t bytes    = data[6];
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-			printf("   WRITE_COIL_MULTI: %04x count %04x (%d bytes data)\n", address, count, bytes);
-#endif
-			if(bytes * 8 >= count)
+			uint8_t bytes = data[2];
+			
+			if((bytes < 9) || (bytes > 0xFB) || (size < 5 + bytes))
 			{
-				if(device->writecoil)
-				{
-					uint16_t i = 0;
-					for(i = 0; i < count; i++)
-					{
-						uint8_t  offset = 7 + (i / 16) * 2;
-						uint8_t  bit  = (i % 0x10);
-						uint16_t mask = get_u16_value(data, offset);
-						uint16_t reg  = address + i;
-						bool value = (mask & (1 << bit)) != 0;
-						
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
-						printf("    REG %04x = %d\n", reg, value ? 1 : 0);
-#endif
-						error = device->writecoil(reg, value);
-						if(error != ERROR_OK)
-							break;
-					}
-					if((error == ERROR_OK) && (data[0] != 255))
-					{
-						uint8_t result[6];
-						result[0] = data[0]; // slave address
-						result[1] = func;    // function code
-						set_u16_value(result, 2, address);
-						set_u16_value(result, 4, count);
-						
-						nyamodbus_send_packet(device->device, result, 6);
-					}
-				}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
-				else
-					puts("    No handler: device->writecoil");
+				puts("    Invalid count/size");
 #endif
+				error = ERROR_INV_REQ_VALUE;
 			}
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
-			else
+			else if(device->files)
 			{
-				puts("    Invalid count/size");
+				error = nyamodbus_slave_writefiles(device, &data[3], bytes);
+				
+				// Request is echoed
+				if((error == ERROR_OK) && !broadcast)
+					nyamodbus_send_packet(device->device, data, 3 + bytes);
 			}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+			else
+				puts("    No handler: device->files");
 #endif
 		}
 		break;
 		
-	case FUNCTION_WRITE_HOLDING_MULTI:
-		// AH AL CH CL SZ DATA
+	case FUNCTION_READ_FIFO:
+		// PH PL
 		{
 			uint16_t address = get_u16_value(data, 2);
-			uint16_t count   = get_u16_value(data, 4);
-			uint8_t bytes    = data[6];
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-			printf("   WRITE_HOLDING_MULTI: %04x count %04x  (%d bytes data)\n", address, count, bytes);
+			printf("   READ_FIFO: %04x\n", address);
 #endif
-			if(bytes == count * 2)
+			if(size < 6)
+			{
+				error = ERROR_INV_REQ_VALUE;
+			}
+			else if(device->getfifo)
 			{
-				if(device->writeholding)
+				str_nyamodbus_fifo * fifo = device->getfifo(address);
+				
+				if(fifo)
 				{
-					uint16_t i = 0;
-					for(i = 0; i < count; i++)
-					{
-						uint16_t value = get_u16_value(data, 7 + i * 2);
-						uint16_t reg   = address + i;
-						
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-						printf("    REG %04x = %04x\n", reg, value);
-#endif
-						error = device->writeholding(reg, value);
-						if(error != ERROR_OK)
-							break;
-					}
-					if((error == ERROR_OK) && (data[0] != 255))
-					{
-						uint8_t result[6];
-						result[0] = data[0]; // slave address
-						result[1] = func;    // function code
-						set_u16_value(result, 2, address);
-						set_u16_value(result, 4, count);
-						
-						nyamodbus_send_packet(device->device, result, 6);
-					}
+					uint8_t  result[6 + NYAMODBUS_FIFO_MAX_COUNT * 2];
+					uint16_t values[NYAMODBUS_FIFO_MAX_COUNT];
+					
+					// Values are not removed: answer can be lost, application removes confirmed values
+					uint16_t count = nyamodbus_fifo_peek(fifo, values, NYAMODBUS_FIFO_MAX_COUNT);
+					
+					result[0] = *device->address;
+					result[1] = FUNCTION_READ_FIFO;
+					set_u16_value(result, 2, 2 + count * 2); // bytes after byte count
+					set_u16_value(result, 4, count);
+					nyamodbus_encode_u16(&result[6], values, count);
+					
+					nyamodbus_send_packet(device->device, result, 6 + count * 2);
+					error = ERROR_OK;
 				}
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 				else
-					puts("    No handler: device->writeholding");
-#endif
+					error = ERROR_NO_DATAADDRESS;
 			}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
-			{
-				puts("    Invalid count/size");
-			}
+				puts("    No handler: device->getfifo");
 #endif
 		}
 		break;
 		
 	case FUNCTION_REPORT_SLAVE_ID:
+		if(device->reportslaveid)
+		{
+			uint8_t result[NYAMODBUS_OUTPUT_BUFFER_SIZE - 2];
+			uint8_t bytes = device->reportslaveid(&result[3], sizeof(result) - 3);
+			
+			result[0] = *device->address;
+			result[1] = FUNCTION_REPORT_SLAVE_ID;
+			result[2] = bytes;
+			
+			nyamodbus_send_packet(device->device, result, 3 + bytes);
+			error = ERROR_OK;
+		}
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+		else
+			puts("    No handler: device->reportslaveid");
+#endif
 		break;
 		
 	case FUNCTION_READ_DEVICE_IDENTIFICATION:
+		// MEI CODE OBJ
 		{
-			uint8_t subfunc    = data[2];
-			uint8_t product_id = data[3];
-			//uint8_t object     = data[4];
+			uint8_t subfunc = data[2];
+			uint8_t devcode = data[3];
+			uint8_t object  = data[4];
 			
-			if(subfunc == 0x0E)
+			if((subfunc == 0x0E) && (size >= 7))
 			{
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
-				printf("   READ_DEVICE_IDENTIFICATION: product %02x\n", product_id);
+				printf("   READ_DEVICE_IDENTIFICATION: code %02x object %02x\n", devcode, object);
 #endif
 				if(device->readdeviceinfo)
 				{
-					uint8_t obj;
-					uint8_t bytes = 8;
-					uint8_t result[NYAMODBUS_OUTPUT_BUFFER_SIZE];
-					result[0] = *device->address; // slave address
-					result[1] = data[1];                 // function code
-					result[2] = subfunc;
-					result[3] = product_id;
-					result[4] = 1; // conformity
-					result[5] = 0; // more follows
-					result[6] = 0; // next object id
-					result[7] = 3;
-					
-					for(obj = 0; obj < 3; obj++)
+					if(device->identity)
 					{
-						uint8_t   buffer_size = NYAMODBUS_OUTPUT_BUFFER_SIZE - bytes - 2;
-						uint8_t * dst = &result[bytes + 2];
-						const char * id = device->readdeviceinfo(obj);
-						
-						error = nyamodbus_slave_readdeviceinfo(id, dst, &buffer_size);
-						if(error != ERROR_OK)
-							break;
-						
-						result[bytes++] = obj;
-						result[bytes++] = buffer_size;
+						if(!device->identity->valid)
+							nyamodbus_slave_identity_encode(device, device->identity);
 						
-						bytes += buffer_size;
+						error = nyamodbus_slave_identification(device, device->identity, devcode, object);
 					}
-					
-					nyamodbus_send_packet(device->device, result, bytes);
+					else
+						error = nyamodbus_slave_identification(device, 0, devcode, object);
 				}
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 				else
-					puts("    No handler: device->config->readdeviceinfo");
+					puts("    No handler: device->readdeviceinfo");
 #endif
 			}
-#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 			else
+			{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
 				puts("Unkonown subfunction code for 43 function");
 #endif
+				error = ERROR_INV_REQ_VALUE;
+			}
 		}
 		break;
 	}
@@ -463,6 +1240,24 @@ static enum_nyamodbus_error nyamodbus_slave_process(const str_nyamodbus_slave_de
 	return error;
 }
 
+// Is function code of write request
+// function: function code
+static bool nyamodbus_slave_is_write(uint8_t function)
+{
+	switch(function)
+	{
+		case FUNCTION_WRITE_COIL_SINGLE:
+		case FUNCTION_WRITE_HOLDING_SINGLE:
+		case FUNCTION_WRITE_COIL_MULTI:
+		case FUNCTION_WRITE_HOLDING_MULTI:
+		case FUNCTION_MASK_WRITE_HOLDING:
+			return true;
+			
+		default:
+			return false;
+	}
+}
+
 // Any data received
 static void nyamodbus_slave_on_data(void * context)
 {
@@ -472,27 +1267,145 @@ static void nyamodbus_slave_on_data(void * context)
 	nyamodbus_reset_timeout(device->device);
 }
 
-// Function to parse modbus packet
-//   data: data
-//   size: size of data
-static void nyamodbus_slave_on_valid_packet(void * context, const uint8_t * data, uint16_t size)
+// Defer request (handler returned ERROR_PENDING)
+//    device: device context
+//      data: request
+//      size: request size
+// broadcast: request is broadcast
+//    return: error code to answer (ERROR_OK - no answer)
+static enum_nyamodbus_error nyamodbus_slave_defer(const str_nyamodbus_slave_device * device, const uint8_t * data, uint16_t size, bool broadcast)
+{
+	str_nyamodbus_slave_state * state = device->state;
+	
+	// Only one request can be deferred: result of completed request is kept until it is repeated
+	if(!state || (size > sizeof(state->request)) || (SLAVE_STATUS_LOAD(&state->status) != SLAVE_REQUEST_NONE))
+		return ERROR_BUSY;
+	
+	memcpy(state->request, data, size);
+	state->size      = size;
+	state->broadcast = broadcast;
+	state->error     = ERROR_OK;
+	if(++state->token == 0)
+		state->token = 1;
+	
+	SLAVE_STATUS_STORE(&state->status, SLAVE_REQUEST_PENDING);
+	
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+	printf("  Deferred request: token %d\n", state->token);
+#endif
+	if(device->on_deferred)
+		device->on_deferred(state->token, data[1]);
+	
+#if NYAMODBUS_SLAVE_PENDING_ACK
+	return ERROR_LONG_ACTION;
+#else
+	return ERROR_OK;
+#endif
+}
+
+// Process request and send answer
+//    device: device context
+//      data: request
+//      size: request size
+// broadcast: request is broadcast
+// completed: request is processed again after completion
+static void nyamodbus_slave_execute(const str_nyamodbus_slave_device * device, const uint8_t * data, uint16_t size, bool broadcast, bool completed)
+{
+	enum_nyamodbus_error error;
+	
+	if(completed)
+		device->state->completed = true;
+	
+	error = nyamodbus_slave_process(device, data, size, broadcast);
+	
+	if(completed)
+	{
+		device->state->completed = false;
+		
+		// Handler must return result after completion
+		if(error == ERROR_PENDING)
+			error = ERROR_UNRECOVERABLE;
+	}
+	else if(error == ERROR_PENDING)
+		error = nyamodbus_slave_defer(device, data, size, broadcast);
+	
+	if((error != ERROR_OK) && !broadcast)
+	{
+		// Send error packet
+		nyamodbus_slave_send_error(device, data[1], error);
+	}
+}
+
+// Check deferred request before processing new request
+//    device: device context
+//      data: request
+//      size: request size
+// broadcast: request is broadcast
+// completed: request is repeated after completion
+//    return: true, if request must be processed
+static bool nyamodbus_slave_check_deferred(const str_nyamodbus_slave_device * device, const uint8_t * data, uint16_t size, bool broadcast, bool * completed)
+{
+	str_nyamodbus_slave_state * state = device->state;
+	bool same;
+	
+	*completed = false;
+	if(!state)
+		return true;
+	
+	same = (size == state->size) && (memcmp(data, state->request, size) == 0);
+	switch(SLAVE_STATUS_LOAD(&state->status))
+	{
+		case SLAVE_REQUEST_PENDING:
+		case SLAVE_REQUEST_CLAIMED:
+		case SLAVE_REQUEST_COMPLETE:
+			// Only one request can be deferred
+			if(!broadcast)
+				nyamodbus_slave_send_error(device, data[1], (same && NYAMODBUS_SLAVE_PENDING_ACK) ? ERROR_LONG_ACTION : ERROR_BUSY);
+			return false;
+			
+		case SLAVE_REQUEST_DONE:
+			// Other requests are processed as usual, result is kept for repeated request
+			if(!same)
+				return true;
+			
+			// Repeated request after acknowledge: handlers return result now
+			SLAVE_STATUS_STORE(&state->status, SLAVE_REQUEST_NONE);
+			if(state->error != ERROR_OK)
+			{
+				if(!broadcast)
+					nyamodbus_slave_send_error(device, data[1], (enum_nyamodbus_error)state->error);
+				return false;
+			}
+			*completed = true;
+			return true;
+			
+		default:
+			return true;
+	}
+}
+
+// Process valid packet (address of packet is checked)
+// device: device context
+//   data: packet data
+//   size: packet size include crc
+void nyamodbus_slave_dispatch(const str_nyamodbus_slave_device * device, const uint8_t * data, uint16_t size)
 {
-	str_nyamodbus_slave_device * device = (str_nyamodbus_slave_device *)context;
 	uint8_t slave     = data[0];
-	bool    broadcast = (slave == 255);
+	bool    broadcast = nyamodbus_is_broadcast(slave);
+	bool    completed;
 	
-	// Check slave address
-	if((slave == *device->address) || broadcast)
+	// Check slave address, only write requests can be broadcast
+	if((slave == *device->address) || (broadcast && nyamodbus_slave_is_write(data[1])))
 	{
 #if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
 		printf("  Slave ok: %02x\n", slave);
 #endif
-		enum_nyamodbus_error error = nyamodbus_slave_process(device, data, size, broadcast);
-		if((error != ERROR_OK) && !broadcast)
-		{
-			// Send error packet
-			nyamodbus_slave_send_error(device, data[1], error);
-		}
+		nyamodbus_stats_count(device->device, STAT_SLAVE_MESSAGES);
+		if(broadcast)
+			nyamodbus_stats_count(device->device, STAT_NO_RESPONSES);
+		
+		if(nyamodbus_slave_check_deferred(device, data, size, broadcast, &completed))
+			nyamodbus_slave_execute(device, data, size, broadcast, completed);
 	}
 	else
 	{
@@ -502,16 +1415,73 @@ static void nyamodbus_slave_on_valid_packet(void * context, const uint8_t * data
 	}
 }
 
+// Function to parse modbus packet
+//   data: data
+//   size: size of data
+static void nyamodbus_slave_on_valid_packet(void * context, const uint8_t * data, uint16_t size)
+{
+	nyamodbus_slave_dispatch((const str_nyamodbus_slave_device *)context, data, size);
+}
+
+// Check packet address before receiving
+// address: first byte of packet
+//  return: true, if packet is for slave or broadcast
+static bool nyamodbus_slave_accept_address(void * context, uint8_t address)
+{
+	str_nyamodbus_slave_device * device = (str_nyamodbus_slave_device *)context;
+	
+	return (address == *device->address) || nyamodbus_is_broadcast(address);
+}
+
 // Invalid packet
 static void nyamodbus_slave_on_invalid_packet(void * context)
 {
 	
 }
 
+// Prepare slave configuration (check maps, encode caches)
+// device: device context
+static void nyamodbus_slave_prepare(const str_nyamodbus_slave_device * device)
+{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+	if(device->holdingmap && !nyamodbus_regmap_check(device->holdingmap))
+		puts("Slave: invalid holding map");
+	
+	if(device->inputmap && !nyamodbus_regmap_check(device->inputmap))
+		puts("Slave: invalid input map");
+#endif
+	if(device->identity && device->readdeviceinfo)
+		nyamodbus_slave_identity_encode(device, device->identity);
+}
+
+// Send response to completed deferred request
+// device: device context
+static void nyamodbus_slave_poll(const str_nyamodbus_slave_device * device)
+{
+	str_nyamodbus_slave_state * state = device->state;
+	
+	if(state && (SLAVE_STATUS_LOAD(&state->status) == SLAVE_REQUEST_COMPLETE))
+	{
+#if NYAMODBUS_SLAVE_PENDING_ACK
+		// Master will repeat request
+		state->done_us = 0;
+		SLAVE_STATUS_STORE(&state->status, SLAVE_REQUEST_DONE);
+#else
+		SLAVE_STATUS_STORE(&state->status, SLAVE_REQUEST_NONE);
+		
+		if(state->error == ERROR_OK)
+			nyamodbus_slave_execute(device, state->request, state->size, state->broadcast, true);
+		else if(!state->broadcast)
+			nyamodbus_slave_send_error(device, state->request[1], (enum_nyamodbus_error)state->error);
+#endif
+	}
+}
+
 // Init slave modbus state
 // device: device context
 void nyamodbus_slave_init(const str_nyamodbus_slave_device * device)
 {
+	nyamodbus_slave_prepare(device);
 	nyamodbus_init(device->device);
 }
 
@@ -520,6 +1490,7 @@ void nyamodbus_slave_init(const str_nyamodbus_slave_device * device)
 void nyamodbus_slave_main(const str_nyamodbus_slave_device * device)
 {
 	nyamodbus_main(device->device, &slave_driver, (void*)device);
+	nyamodbus_slave_poll(device);
 }
 
 // Trigger modbus timeout (parse received data)
@@ -528,13 +1499,28 @@ void nyamodbus_slave_timeout(const str_nyamodbus_slave_device * device)
 	nyamodbus_timeout(device->device, &slave_driver, (void *)device);
 }
 
-// Trigger modbus timeout (parse received data)
+// Trigger modbus timeout (parse received data, drop result of deferred request that is not repeated)
 //  device: device context
 //   usecs: useconds after last call
 // context: driver context
 void nyamodbus_slave_tick(const str_nyamodbus_slave_device * device, uint32_t usecs)
 {
+	str_nyamodbus_slave_state * state = device->state;
+	
 	nyamodbus_tick(device->device, &slave_driver, (void*)device, usecs);
+	
+	// Master does not repeat acknowledged request: result is dropped
+	if(state && (SLAVE_STATUS_LOAD(&state->status) == SLAVE_REQUEST_DONE))
+	{
+		state->done_us += usecs;
+		if(state->done_us >= NYAMODBUS_SLAVE_DONE_TIMEOUT)
+		{
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 1)
+			printf("  Deferred request is not repeated: token %d\n", state->token);
+#endif
+			SLAVE_STATUS_STORE(&state->status, SLAVE_REQUEST_NONE);
+		}
+	}
 }
 
 // Reset modbus state
@@ -542,3 +1528,145 @@ void nyamodbus_slave_reset(const str_nyamodbus_slave_device * device)
 {
 	nyamodbus_reset(device->device);
 }
+
+// Complete deferred request (can be called from any thread)
+//  device: device context
+//   token: token of request
+//   error: ERROR_OK - process request again, else send error
+// return: true, if request with token is pending
+bool nyamodbus_slave_complete(const str_nyamodbus_slave_device * device, uint16_t token, enum_nyamodbus_error error)
+{
+	str_nyamodbus_slave_state * state = device->state;
+	uint8_t expected = SLAVE_REQUEST_PENDING;
+	
+	if(!state || (SLAVE_STATUS_LOAD(&state->status) != SLAVE_REQUEST_PENDING) || (state->token != token))
+		return false;
+	
+	// Request is claimed first: other completer can not overwrite result
+	if(!SLAVE_STATUS_CAS(&state->status, expected, SLAVE_REQUEST_CLAIMED))
+		return false;
+	
+	state->error = (uint8_t)error;
+	SLAVE_STATUS_STORE(&state->status, SLAVE_REQUEST_COMPLETE);
+	return true;
+}
+
+// Is completed deferred request processed now (for handlers: ERROR_PENDING is not allowed then)
+// device: device context
+// return: true, if handler is called again after nyamodbus_slave_complete()
+bool nyamodbus_slave_is_completed(const str_nyamodbus_slave_device * device)
+{
+	return device->state && device->state->completed;
+}
+
+// Any data received by host
+static void nyamodbus_slave_host_on_data(void * context)
+{
+	str_nyamodbus_slave_host * host = (str_nyamodbus_slave_host *)context;
+	
+	nyamodbus_start_timeout(host->device);
+	nyamodbus_reset_timeout(host->device);
+}
+
+// Check packet address before receiving by host
+// address: first byte of packet
+//  return: true, if packet is for any unit or broadcast
+static bool nyamodbus_slave_host_accept_address(void * context, uint8_t address)
+{
+	str_nyamodbus_slave_host * host = (str_nyamodbus_slave_host *)context;
+	
+	return (host->state->unit[address] != 0) || nyamodbus_is_broadcast(address);
+}
+
+// Function to parse modbus packet by host
+//   data: data
+//   size: size of data
+static void nyamodbus_slave_host_on_valid_packet(void * context, const uint8_t * data, uint16_t size)
+{
+	nyamodbus_slave_host_dispatch((const str_nyamodbus_slave_host *)context, data, size);
+}
+
+// Process valid packet by unit with packet address (broadcast is processed by all units)
+// host: host context
+// data: packet data
+// size: packet size include crc
+void nyamodbus_slave_host_dispatch(const str_nyamodbus_slave_host * host, const uint8_t * data, uint16_t size)
+{
+	if(nyamodbus_is_broadcast(data[0]))
+	{
+		uint8_t i;
+		for(i = 0; i < host->unit_count; i++)
+			nyamodbus_slave_dispatch(host->units[i], data, size);
+	}
+	else
+	{
+		uint8_t index = host->state->unit[data[0]];
+		
+		if(index != 0)
+			nyamodbus_slave_dispatch(host->units[index - 1], data, size);
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 2)
+		else
+			printf("  Host: no unit %02x\n", data[0]);
+#endif
+	}
+}
+
+// Update unit table (call if address of any unit was changed)
+// host: host context
+void nyamodbus_slave_host_update(const str_nyamodbus_slave_host * host)
+{
+	uint8_t i;
+	
+	memset(host->state->unit, 0, sizeof(host->state->unit));
+	for(i = 0; (i < host->unit_count) && (i < 255); i++)
+	{
+		uint8_t address = *host->units[i]->address;
+		
+		if(host->state->unit[address] == 0)
+			host->state->unit[address] = i + 1;
+#if defined(DEBUG_OUTPUT) && (DEBUG_OUTPUT > 0)
+		else
+			printf("Host: duplicate unit address %02x\n", address);
+#endif
+	}
+}
+
+// Init slave host state
+// host: host context
+void nyamodbus_slave_host_init(const str_nyamodbus_slave_host * host)
+{
+	uint8_t i;
+	
+	for(i = 0; i < host->unit_count; i++)
+		nyamodbus_slave_prepare(host->units[i]);
+	
+	nyamodbus_slave_host_update(host);
+	nyamodbus_init(host->device);
+}
+
+// Process slave host state
+// host: host context
+void nyamodbus_slave_host_main(const str_nyamodbus_slave_host * host)
+{
+	uint8_t i;
+	
+	nyamodbus_main(host->device, &slave_host_driver, (void*)host);
+	
+	for(i = 0; i < host->unit_count; i++)
+		nyamodbus_slave_poll(host->units[i]);
+}
+
+// Trigger modbus timeout (parse received data)
+// host: host context
+void nyamodbus_slave_host_timeout(const str_nyamodbus_slave_host * host)
+{
+	nyamodbus_timeout(host->device, &slave_host_driver, (void *)host);
+}
+
+// Update slave host timeouts
+//  host: host context
+// usecs: useconds after last call
+void nyamodbus_slave_host_tick(const str_nyamodbus_slave_host * host, uint32_t usecs)
+{
+	nyamodbus_tick(host->device, &slave_host_driver, (void*)host, usecs);
+}
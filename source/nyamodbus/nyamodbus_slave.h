@@ -9,11 +9,89 @@
 #define _NYAMODBUS_SLAVE_H
 
 #include "nyamodbus.h"
+#include "nyamodbus_regmap.h"
+#include "nyamodbus_bits.h"
+#include "nyamodbus_fifo.h"
+#include "nyamodbus_file.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+	// Deferred request status
+	typedef enum {
+		SLAVE_REQUEST_NONE,     // No deferred request
+		SLAVE_REQUEST_PENDING,  // Handler returned ERROR_PENDING, waiting for nyamodbus_slave_complete()
+		SLAVE_REQUEST_CLAIMED,  // nyamodbus_slave_complete() is storing result
+		SLAVE_REQUEST_COMPLETE, // Completed, response will be sent by nyamodbus_slave_main()
+		SLAVE_REQUEST_DONE      // Completed and acknowledged, waiting for repeated request (NYAMODBUS_SLAVE_PENDING_ACK)
+	} enum_nyamodbus_slave_request;
+
+	// Slave state (for deferred requests)
+	typedef struct {
+		// Deferred request
+		uint8_t    request[NYAMODBUS_BUFFER_SIZE];
+		uint16_t   size;
+		bool       broadcast;
+		
+		// Token of deferred request
+		uint16_t   token;
+		// Deferred request status (enum_nyamodbus_slave_request)
+		uint8_t    status;
+		// Completion result
+		uint8_t    error;
+		// Request is processed again after completion
+		bool       completed;
+		// Usecs after acknowledge of completion (SLAVE_REQUEST_DONE), result is dropped after NYAMODBUS_SLAVE_DONE_TIMEOUT
+		uint32_t   done_us;
+	} str_nyamodbus_slave_state;
+
+	// Device identification cache (FC43), encoded once from readdeviceinfo
+	typedef struct {
+		// Encoded objects sorted by id: id, length, value
+		uint8_t    data[NYAMODBUS_IDENTITY_CACHE_SIZE];
+		uint16_t   size;
+		
+		// Highest object id
+		uint8_t    last;
+		
+		// Objects are encoded
+		bool       valid;
+	} str_nyamodbus_slave_identity;
+
+	// Cached response
+	typedef struct {
+		// Request: function, first register, register count
+		uint8_t    function;
+		uint16_t   start;
+		uint16_t   count;
+		
+		// Generation of register map
+		uint32_t   generation;
+		
+		// Response with crc
+		uint8_t    frame[NYAMODBUS_OUTPUT_BUFFER_SIZE];
+		uint8_t    size;
+	} str_nyamodbus_slave_cache_entry;
+
+	// Response cache for REGMAP_CACHED ranges of holding and input maps
+	typedef struct {
+		str_nyamodbus_slave_cache_entry entries[NYAMODBUS_RESPONSE_CACHE_SIZE];
+		
+		// Entry to replace
+		uint8_t    next;
+	} str_nyamodbus_slave_cache;
+
+	// Request is deferred (handler returned ERROR_PENDING)
+	//    token: token to complete request with nyamodbus_slave_complete()
+	// function: function code
+	typedef void (*nyamb_deferred)(uint16_t token, uint8_t function);
+
+	// Get FIFO queue (FC24)
+	// address: FIFO pointer address
+	//  return: queue or 0, if address is not available
+	typedef str_nyamodbus_fifo * (*nyamb_getfifo)(uint16_t address);
+
 	// Driver configuration
 	typedef struct {
 		// Pointer to modbus struct
@@ -25,6 +103,9 @@ extern "C" {
 		// Read device information
 		nyamb_readdeviceinfo         readdeviceinfo;
 		
+		// Device information cache (optional, objects are encoded on every request if not set)
+		str_nyamodbus_slave_identity * identity;
+		
 		// Read contacts
 		nyamb_readdigital            readcontacts;
 		
@@ -42,8 +123,99 @@ extern "C" {
 		
 		// Write holding register
 		nyamb_writeholding           writeholding;
+		
+		// Mask write holding register (optional, readholding and writeholding are used if not set)
+		nyamb_maskwriteholding       maskwriteholding;
+		
+		// Block handlers (optional, used instead of per-item handlers if set)
+		// Read contacts block
+		nyamb_readdigital_range      readcontacts_range;
+		
+		// Read analog inputs block
+		nyamb_readanalog_range       readanalog_range;
+		
+		// Read coil status block
+		nyamb_readdigital_range      readcoils_range;
+		
+		// Write coil status block
+		nyamb_writecoil_range        writecoil_range;
+		
+		// Read holding registers block
+		nyamb_readanalog_range       readholding_range;
+		
+		// Write holding registers block
+		nyamb_writeholding_range     writeholding_range;
+		
+		// Register maps (optional, used instead of handlers if set)
+		// Holding registers map
+		const str_nyamodbus_regmap * holdingmap;
+		
+		// Analog inputs map
+		const str_nyamodbus_regmap * inputmap;
+		
+		// Response cache for maps (optional)
+		str_nyamodbus_slave_cache *  cache;
+		
+		// Write transactions (optional): whole request is validated before write,
+		// one notification is sent after write
+		// Validate coils block
+		nyamb_validatecoils          validatecoils;
+		
+		// Validate holding registers block
+		nyamb_validateholding        validateholding;
+		
+		// Coils block was written
+		nyamb_changed                coilschanged;
+		
+		// Holding registers block was written
+		nyamb_changed                holdingchanged;
+		
+		// Deferred requests (optional): state and notification
+		str_nyamodbus_slave_state *  state;
+		nyamb_deferred               on_deferred;
+		
+		// Bit banks (optional, used instead of handlers if set)
+		// Contacts bank
+		const str_nyamodbus_bitbank * contactbank;
+		
+		// Coils bank
+		const str_nyamodbus_bitbank * coilbank;
+		
+		// FIFO queues (optional), FC24 reads values without removing, application removes them with nyamodbus_fifo_drop()
+		nyamb_getfifo                getfifo;
+		
+		// Record files (optional) [file_count]
+		const str_nyamodbus_file *   files;
+		uint16_t                     file_count;
+		
+		// Read exception status (FC07)
+		nyamb_readexceptionstatus    readexceptionstatus;
+		
+		// Report slave id (FC17)
+		nyamb_reportslaveid          reportslaveid;
 	} str_nyamodbus_slave_device;
 	
+	// Slave host state
+	typedef struct {
+		// Unit index + 1 by slave address (0 - no unit)
+		uint8_t    unit[256];
+	} str_nyamodbus_slave_host_state;
+
+	// Slave host: one port (parser) for many slave units
+	typedef struct {
+		// Pointer to modbus struct (shared by all units)
+		const str_nyamodbus_device *         device;
+		
+		// Host state
+		str_nyamodbus_slave_host_state *     state;
+		
+		// Units, device field of unit must point to host device [unit_count]
+		const str_nyamodbus_slave_device * const * units;
+		
+		// Unit count (max 255)
+		uint8_t                              unit_count;
+	} str_nyamodbus_slave_host;
+	
 	// Init slave modbus state
 	// device: device context
 	void nyamodbus_slave_init(const str_nyamodbus_slave_device * device);
@@ -55,7 +227,7 @@ extern "C" {
 	// Trigger modbus timeout (parse received data)
 	void nyamodbus_slave_timeout(const str_nyamodbus_slave_device * device);
 
-	// Trigger modbus timeout (parse received data)
+	// Trigger modbus timeout (parse received data, drop result of deferred request that is not repeated)
 	//  device: device context
 	//   usecs: useconds after last call
 	// context: driver context
@@ -64,6 +236,56 @@ extern "C" {
 	// Reset modbus state
 	void nyamodbus_slave_reset(const str_nyamodbus_slave_device * device);
 
+	// Complete deferred request (can be called from any thread)
+	// Request is processed again by nyamodbus_slave_main(), handlers must return result then
+	//  device: device context
+	//   token: token of request
+	//   error: ERROR_OK - process request again, else send error
+	// return: true, if request with token is pending
+	bool nyamodbus_slave_complete(const str_nyamodbus_slave_device * device, uint16_t token, enum_nyamodbus_error error);
+
+	// Is completed deferred request processed now (for handlers: ERROR_PENDING is not allowed then)
+	// device: device context
+	// return: true, if handler is called again after nyamodbus_slave_complete()
+	bool nyamodbus_slave_is_completed(const str_nyamodbus_slave_device * device);
+
+	// Device information was changed, it will be encoded again on next request
+	// device: device context
+	void nyamodbus_slave_identity_invalidate(const str_nyamodbus_slave_device * device);
+
+	// Process valid packet (address of packet is checked)
+	// device: device context
+	//   data: packet data
+	//   size: packet size include crc
+	void nyamodbus_slave_dispatch(const str_nyamodbus_slave_device * device, const uint8_t * data, uint16_t size);
+
+	// Init slave host state
+	// host: host context
+	void nyamodbus_slave_host_init(const str_nyamodbus_slave_host * host);
+
+	// Update unit table (call if address of any unit was changed)
+	// host: host context
+	void nyamodbus_slave_host_update(const str_nyamodbus_slave_host * host);
+
+	// Process slave host state
+	// host: host context
+	void nyamodbus_slave_host_main(const str_nyamodbus_slave_host * host);
+
+	// Trigger modbus timeout (parse received data)
+	// host: host context
+	void nyamodbus_slave_host_timeout(const str_nyamodbus_slave_host * host);
+
+	// Update slave host timeouts
+	//  host: host context
+	// usecs: useconds after last call
+	void nyamodbus_slave_host_tick(const str_nyamodbus_slave_host * host, uint32_t usecs);
+
+	// Process valid packet by unit with packet address (broadcast is processed by all units)
+	// host: host context
+	// data: packet data
+	// size: packet size include crc
+	void nyamodbus_slave_host_dispatch(const str_nyamodbus_slave_host * host, const uint8_t * data, uint16_t size);
+
 #ifdef __cplusplus
 };
 #endif
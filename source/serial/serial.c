@@ -13,14 +13,22 @@
 #include <unistd.h>
 #include <nyamodbus/nyamodbus_utils.h>
 
+// Time of one character at 9600 baud (start, 8 data, stop bits + 1 bit margin), usecs
+#define MBSERIAL_CHAR_US          ((11 * 1000000 + 9599) / 9600)
+
 static str_nyamodbus_state        state;
 
 bool serial_send(const uint8_t * data, uint8_t size);
 bool serial_receive(uint8_t * data, uint8_t * size);
+bool serial_is_txbusy(void);
 
-static const str_modbus_io        io = {
+// Echo flag is set by mbserial_set_echo() before start
+static str_modbus_io              io = {
 	.send           = serial_send,
-	.receive        = serial_receive
+	.receive        = serial_receive,
+	.is_txbusy      = serial_is_txbusy,
+	.echo           = false,
+	.char_us        = MBSERIAL_CHAR_US
 };
 
 // Modbus slave state
@@ -71,6 +79,18 @@ bool serial_send(const uint8_t * data, uint8_t size)
 	return (writed == size);
 }
 
+// Is sending (bytes are in output queue of tty)
+// return: true, if sending
+bool serial_is_txbusy(void)
+{
+	int bytes_queued = 0;
+	
+	if(ioctl(serial_fd, TIOCOUTQ, &bytes_queued) != 0)
+		return false;
+	
+	return bytes_queued > 0;
+}
+
 // Receive slave emulator modbus data
 //   data: data to read
 //   size: size of buffer, size of readed data if result is true
@@ -273,6 +293,14 @@ bool mbserial_slave_start(const char * dev, const str_nyamodbus_slave_device * d
 	}
 }
 
+// Sent bytes are received back (RS-485 adapter without echo suppression), must be set before start
+//   echo: true, if echo is received
+void mbserial_set_echo(bool echo)
+{
+	if(!serial_running)
+		io.echo = echo;
+}
+
 // Stop serial modbus device
 void mbserial_stop(void)
 {
@@ -27,6 +27,10 @@ extern "C" {
 	// return: true, if started
 	bool mbserial_slave_start(const char * dev, const str_nyamodbus_slave_device * device);
 
+	// Sent bytes are received back (RS-485 adapter without echo suppression), must be set before start
+	//   echo: true, if echo is received
+	void mbserial_set_echo(bool echo);
+
 	// Stop serial modbus device
 	void mbserial_stop(void);
 